@@ -2,133 +2,173 @@
 #include "scene.h"
 #include "image.h"
 #include "gls.h"
+#include "soa.h"
 #include "fstream"
+#include <chrono>
 #define pi 3.1415926
 
 std::ofstream fout;
 string scene_filename;  // scene filename
 string image_filename;  // image filename
 Scene* scene;           // scene arrays
+NormalizePrecision normals_precision = normalize_exact; // precision used to normalize computed normals
+string subdivision_cache = "";  // directory of cached subdivision results (empty to disable)
 
 
 void uiloop();          // UI loop
 
 
-// map used to uniquify edges
-struct EdgeMap {
-    map<pair<int,int>,int>  _edge_map;  // internal map
-    vector<vec2i>           _edge_list; // internal list to generate unique ids
-    
-    // create an edge map for a collection of triangles and quads
-    EdgeMap(vector<vec3i> triangle, vector<vec4i> quad) {
-        for(auto f : triangle) { _add_edge(f.x,f.y); _add_edge(f.y,f.z); _add_edge(f.z,f.x); }
-        for(auto f : quad) { _add_edge(f.x,f.y); _add_edge(f.y,f.z); _add_edge(f.z,f.w); _add_edge(f.w,f.x); }
+// compute the normalized cross products of the vector pairs in a and b;
+// results overwrite a and zero-length results stay zero
+// with VMATH_SIMD the loop runs on four pairs at a time, otherwise it is left to the compiler
+void facet_normals_batch(vec3f_soa& a, const vec3f_soa& b, NormalizePrecision precision) {
+    int n = a.size();
+    auto ax = a.x.data(), ay = a.y.data(), az = a.z.data();
+    auto bx = b.x.data(), by = b.y.data(), bz = b.z.data();
+    auto i = 0;
+#if VMATH_SIMD
+    for(; i+4 <= n; i += 4) {
+        auto x0 = _mm_load_ps(ax+i), y0 = _mm_load_ps(ay+i), z0 = _mm_load_ps(az+i);
+        auto x1 = _mm_load_ps(bx+i), y1 = _mm_load_ps(by+i), z1 = _mm_load_ps(bz+i);
+        auto cx = _mm_sub_ps(_mm_mul_ps(y0,z1),_mm_mul_ps(z0,y1));
+        auto cy = _mm_sub_ps(_mm_mul_ps(z0,x1),_mm_mul_ps(x0,z1));
+        auto cz = _mm_sub_ps(_mm_mul_ps(x0,y1),_mm_mul_ps(y0,x1));
+        _simd_normalize(cx, cy, cz, precision);
+        _mm_store_ps(ax+i, cx);
+        _mm_store_ps(ay+i, cy);
+        _mm_store_ps(az+i, cz);
     }
-    
-    // internal function to add an edge
-    void _add_edge(int i, int j) {
-        if(_edge_map.find(make_pair(i,j)) == _edge_map.end()) {
-            _edge_map[make_pair(i,j)] = _edge_list.size();
-            _edge_map[make_pair(j,i)] = _edge_list.size();
-            _edge_list.push_back(vec2i(i,j));
-        }
-    }
-    
-    // edge list
-    const vector<vec2i>& edges() const { return _edge_list; }
-    
-    // get an edge from two vertices
-    int edge_index(vec2i e) const {
-        error_if_not(not (_edge_map.find(make_pair(e.x,e.y)) == _edge_map.end()), "non existing edge");
-        return _edge_map.find(make_pair(e.x, e.y))->second;
+#endif
+    for(; i < n; i++) {
+        auto c = normalize(cross(vec3f(ax[i],ay[i],az[i]), vec3f(bx[i],by[i],bz[i])));
+        ax[i] = c.x; ay[i] = c.y; az[i] = c.z;
     }
-};
-
+}
 
 // make normals for each face - duplicates all vertex data
+// face normals are computed in one batch over aligned structure-of-arrays buffers, then the
+// de-indexed vertex streams are written in one pass into presized arrays
 void facet_normals(Mesh* mesh) {
+    int ntriangles = mesh->triangle.size();
+    int nfaces = ntriangles + mesh->quad.size();
+    auto has_texcoord = not mesh->texcoord.empty();
+    
+    // gather two edge vectors for each face: for triangles the edges from the first vertex,
+    // for quads the two diagonals, whose cross product is the sum of the two triangle ones, so that
+    // quad normals are weighted by triangle area (they used to be normalize(n_abc)+normalize(n_acd),
+    // which weights both triangles the same and differs on non-planar quads of unequal triangles)
+    auto fa = vec3f_soa(nfaces), fb = vec3f_soa(nfaces);
+    parallel_for(nfaces, [&](int i) {
+        auto a = zero3f, b = zero3f;
+        if(i < ntriangles) {
+            auto f = mesh->triangle[i];
+            a = mesh->pos[f.y]-mesh->pos[f.x]; b = mesh->pos[f.z]-mesh->pos[f.x];
+        } else {
+            auto f = mesh->quad[i-ntriangles];
+            a = mesh->pos[f.z]-mesh->pos[f.x]; b = mesh->pos[f.w]-mesh->pos[f.y];
+        }
+        fa.set(i, a);
+        fb.set(i, b);
+    });
+    
+    // compute face normals
+    facet_normals_batch(fa, fb, normals_precision);
+    
     // allocates new arrays
-    auto pos = vector<vec3f>();
-    auto norm = vector<vec3f>();
-    auto texcoord = vector<vec2f>();
-    auto triangle = vector<vec3i>();
-    auto quad = vector<vec4i>();
+    int quadZ = ntriangles*3;
+    auto pos = vector<vec3f>(quadZ + mesh->quad.size()*4);
+    auto norm = vector<vec3f>(pos.size());
+    auto texcoord = vector<vec2f>(has_texcoord ? pos.size() : 0);
+    auto triangle = vector<vec3i>(ntriangles);
+    auto quad = vector<vec4i>(mesh->quad.size());
     
-    // foreach triangle
-    for(auto f : mesh->triangle) {
-        // grab current pos size
-        auto nv = (int)pos.size();
-        // compute face face normal
-        auto fn = normalize(cross(mesh->pos[f.y]-mesh->pos[f.x], mesh->pos[f.z]-mesh->pos[f.x]));
-        // add triangle
-        triangle.push_back({nv,nv+1,nv+2});
-        // add vertex data
-        for(auto i : range(3)) {
-            pos.push_back(mesh->pos[f[i]]);
-            norm.push_back(fn);
-            if(not mesh->texcoord.empty()) texcoord.push_back(mesh->texcoord[f[i]]);
+    // foreach triangle, add triangle and vertex data
+    parallel_for(ntriangles, [&](int i) {
+        auto f = mesh->triangle[i];
+        auto nv = i*3;
+        triangle[i] = {nv,nv+1,nv+2};
+        for(auto k : range(3)) {
+            pos[nv+k] = mesh->pos[f[k]];
+            norm[nv+k] = fa.get(i);
+            if(has_texcoord) texcoord[nv+k] = mesh->texcoord[f[k]];
         }
-    }
+    });
     
-    // foreach quad
-    for(auto f : mesh->quad) {
-        // grab current pos size
-        auto nv = (int)pos.size();
-        // compute face normal
-        auto fn = normalize(normalize(cross(mesh->pos[f.y]-mesh->pos[f.x], mesh->pos[f.z]-mesh->pos[f.x])) +
-                            normalize(cross(mesh->pos[f.z]-mesh->pos[f.x], mesh->pos[f.w]-mesh->pos[f.x])));
-        // add quad
-        quad.push_back({nv,nv+1,nv+2,nv+3});
-        // add vertex data
-        for(auto i : range(4)) {
-            pos.push_back(mesh->pos[f[i]]);
-            norm.push_back(fn);
-            if(not mesh->texcoord.empty()) texcoord.push_back(mesh->texcoord[f[i]]);
+    // foreach quad, add quad and vertex data
+    parallel_for(mesh->quad.size(), [&](int i) {
+        auto f = mesh->quad[i];
+        auto nv = quadZ + i*4;
+        quad[i] = {nv,nv+1,nv+2,nv+3};
+        for(auto k : range(4)) {
+            pos[nv+k] = mesh->pos[f[k]];
+            norm[nv+k] = fa.get(ntriangles+i);
+            if(has_texcoord) texcoord[nv+k] = mesh->texcoord[f[k]];
         }
-    }
+    });
     
     // set back mesh data
-    mesh->pos = pos;
-    mesh->norm = norm;
-    mesh->texcoord = texcoord;
-    mesh->triangle = triangle;
-    mesh->quad = quad;
+    mesh->pos = std::move(pos);
+    mesh->norm = std::move(norm);
+    mesh->texcoord = std::move(texcoord);
+    mesh->triangle = std::move(triangle);
+    mesh->quad = std::move(quad);
+    
+    // faces changed, drop cached topology
+    mesh_topology_clear(mesh);
 }
 
 // smooth out normal - does not duplicate data
+// each vertex gathers the normals of its adjacent faces (in face order) using the mesh topology,
+// weighted according to mesh->subdivision_normal_weighting, so vertices can be processed in parallel
 void smooth_normals(Mesh* mesh) {
-    // set normals array to the same length as pos and init all elements to zero
+    auto topo = mesh_topology(mesh);
+    auto weighting = mesh->subdivision_normal_weighting;
+    int ntriangles = mesh->triangle.size();
+    
+    // foreach face, compute face normal (scaled by twice the face area for area weighting)
+    // quads use the normal of their first triangle, or the cross product of the diagonals for area weighting
+    auto face_norm = vector<vec3f>(ntriangles + mesh->quad.size());
+    parallel_for(ntriangles, [&](int i) {
+        auto f = mesh->triangle[i];
+        auto n = cross(mesh->pos[f.y] - mesh->pos[f.x], mesh->pos[f.z] - mesh->pos[f.x]);
+        face_norm[i] = (weighting == normal_weighting_area) ? n : normalize(n);
+    });
+    parallel_for(mesh->quad.size(), [&](int i) {
+        auto f = mesh->quad[i];
+        if(weighting == normal_weighting_area) face_norm[ntriangles+i] = cross(mesh->pos[f.z] - mesh->pos[f.x], mesh->pos[f.w] - mesh->pos[f.y]);
+        else face_norm[ntriangles+i] = normalize(cross(mesh->pos[f.y] - mesh->pos[f.x], mesh->pos[f.z] - mesh->pos[f.x]));
+    });
+    
+    // interior angle of face at vertex v
+    auto face_angle = [&](int face, int v) {
+        auto n = (face < ntriangles) ? 3 : 4;
+        auto vi = [&](int k) { return (face < ntriangles) ? mesh->triangle[face][k] : mesh->quad[face-ntriangles][k]; };
+        auto k = 0;
+        while(k < n-1 and vi(k) != v) k++;
+        auto e0 = normalize(mesh->pos[vi((k+1)%n)] - mesh->pos[v]);
+        auto e1 = normalize(mesh->pos[vi((k+n-1)%n)] - mesh->pos[v]);
+        return std::acos(clamp(dot(e0,e1),-1.0f,1.0f));
+    };
+    
+    // foreach vertex, accumulate the normals of its faces
     mesh->norm.assign(mesh->pos.size(), zero3f);
+    parallel_for(mesh->pos.size(), [&](int i) {
+        auto n = zero3f;
+        for(auto k : range(topo->vert_face_offset[i],topo->vert_face_offset[i+1])) {
+            auto face = topo->vert_face[k];
+            if(weighting == normal_weighting_angle) n += face_norm[face] * face_angle(face,i);
+            else n += face_norm[face];
+        }
+        mesh->norm[i] = n;
+    });
     
-    put_your_code_here("Implement normal smoothing");
-    
-    vec3f a = mesh->pos[0];
-    for(int i = 0 ; i < mesh->triangle.size() ; ++i){
-        vec3f vector1 = mesh->pos[mesh->triangle[i].y] - mesh->pos[mesh->triangle[i].x];
-        vec3f vector2 = mesh->pos[mesh->triangle[i].z] - mesh->pos[mesh->triangle[i].x];
-        vec3f norm = normalize(cross(vector1,vector2));
-        mesh->norm[mesh->triangle[i].x] += norm;
-        mesh->norm[mesh->triangle[i].y] += norm;
-        mesh->norm[mesh->triangle[i].z] += norm;
-    }
-    for(int i = 0 ; i < mesh->quad.size() ; ++i){
-        vec3f vector1 = mesh->pos[mesh->quad[i].y] - mesh->pos[mesh->quad[i].x];
-        vec3f vector2 = mesh->pos[mesh->quad[i].z] - mesh->pos[mesh->quad[i].x];
-        vec3f norm = normalize(cross(vector1,vector2));
-        mesh->norm[mesh->quad[i].x] += norm;
-        mesh->norm[mesh->quad[i].y] += norm;
-        mesh->norm[mesh->quad[i].z] += norm;
-        mesh->norm[mesh->quad[i].w] += norm;
-    }
-    for(int i = 0 ; i < mesh->norm.size() ; ++i)
-        mesh->norm[i] = normalize(mesh->norm[i]);
-    // foreach triangle
-        // compute face normal
-        // accumulate face normal to the vertex normals of each face index
-    // foreach quad
-        // compute face normal
-        // accumulate face normal to the vertex normals of each face index
-    // normalize all vertex normals
+    // normalize, in blocks of vertices
+    const int block = 4096;
+    int nverts = mesh->norm.size();
+    parallel_for((nverts+block-1)/block, [&](int b) {
+        auto norm = mesh->norm.data() + b*block;
+        normalize_batch(norm, norm, min(block, nverts-b*block), normals_precision);
+    }, 1);
 }
 
 // smooth out tangents
@@ -143,54 +183,57 @@ void smooth_tangents(Mesh* polyline) {
         for (auto i : range(2)) polyline->norm[l[i]] += lt;
     }
     // normalize all vertex tangents
-    for (auto& t : polyline->norm) t = normalize(t);
+    normalize_batch(polyline->norm.data(), polyline->norm.data(), polyline->norm.size(), normals_precision);
 }
 
 // subdivide bezier spline into line segments (assume bezier has only bezier segments and no lines)
 // subdivide using uniform sampling
+// each segment is evaluated by forward differencing its polynomial form, in double precision
+// so that the error does not accumulate over the steps; segments are written in parallel
+// into arrays presized to steps+1 points and steps lines per segment
 void subdivide_bezier_uniform(Mesh *bezier) {
-    auto pos = vector<vec3f>();
-    auto line = vector<vec2i>();
     // determine number of steps
     int steps = 1 << bezier->subdivision_bezier_level;
-    
-    for(int i = 0 ; i < bezier->spline.size() ; ++i){
-        vec3f p0 = bezier->pos[bezier->spline[i].x];
-        vec3f p1 = bezier->pos[bezier->spline[i].y];
-        vec3f p2 = bezier->pos[bezier->spline[i].z];
-        vec3f p3 = bezier->pos[bezier->spline[i].w];
-        int pointL = pos.size();
-        for(int j = 0 ; j <= steps ; ++j){
-            double t = 1.0/steps * j;
-            double b0 = bernstein(t,0,3);
-            double b1 = bernstein(t,1,3);
-            double b2 = bernstein(t,2,3);
-            double b3 = bernstein(t,3,3);
-            vec3f newP = p0*b0 + p1*b1 + p2*b2 + p3*b3;
-
-            pos.push_back(newP);
-        }
-
-        for(int j = 0 ; j < steps ; ++j){
-            line.push_back(vec2i(pointL+j,pointL+j+1));
-        }
-    }
+    auto pos = vector<vec3f>(bezier->spline.size()*(steps+1));
+    auto line = vector<vec2i>(bezier->spline.size()*steps);
     
     // foreach spline segment
         // get control points of segment
         // note the starting index of new points
+        // compute the forward differences of the cubic for a step of 1/steps
         // foreach step
-            // compute t for current segment
-            // compute blending weights
-            // compute new point position
-            // add new point to pos vector
+            // add new point to pos vector and step the differences
         // foreach step
             // create line segment
+    parallel_for(bezier->spline.size(), [&](int i) {
+        auto p0 = bezier->pos[bezier->spline[i].x];
+        auto p1 = bezier->pos[bezier->spline[i].y];
+        auto p2 = bezier->pos[bezier->spline[i].z];
+        auto p3 = bezier->pos[bezier->spline[i].w];
+        int pointL = i*(steps+1);
+        double h = 1.0/steps;
+        double f[3], df[3], d2f[3], d3f[3];
+        for(auto k : range(3)) {
+            double a = -p0[k] + 3.0*p1[k] - 3.0*p2[k] + p3[k];
+            double b = 3.0*p0[k] - 6.0*p1[k] + 3.0*p2[k];
+            double c = -3.0*p0[k] + 3.0*p1[k];
+            f[k] = p0[k];
+            df[k] = a*h*h*h + b*h*h + c*h;
+            d2f[k] = 6*a*h*h*h + 2*b*h*h;
+            d3f[k] = 6*a*h*h*h;
+        }
+        for(auto j : range(steps)) {
+            pos[pointL+j] = vec3f(f[0],f[1],f[2]);
+            for(auto k : range(3)) { f[k] += df[k]; df[k] += d2f[k]; d2f[k] += d3f[k]; }
+        }
+        pos[pointL+steps] = p3;
+        for(auto j : range(steps)) line[i*steps+j] = vec2i(pointL+j,pointL+j+1);
+    });
     
     // copy vertex positions
-    bezier->pos = pos;
+    bezier->pos = std::move(pos);
     // copy line segments
-    bezier->line = line;
+    bezier->line = std::move(line);
     
     // clear bezier array from lines
     bezier->spline.clear();
@@ -200,58 +243,125 @@ void subdivide_bezier_uniform(Mesh *bezier) {
     smooth_tangents(bezier);
 }
 
+// write the interior points of the de casteljau subdivision of the cubic segment p0..p3 after depth
+// levels, in curve order, into the 2^depth-1 elements starting at pos (the end points are not written)
+void subdivide_bezier_decasteljau(const vec3f& p0, const vec3f& p1, const vec3f& p2, const vec3f& p3, int depth, vec3f* pos) {
+    if(not depth) return;
+    auto p01 = (p0 + p1)/2, p12 = (p1 + p2)/2, p23 = (p2 + p3)/2;
+    auto p012 = (p01 + p12)/2, p123 = (p12 + p23)/2;
+    auto mid = (p012 + p123)/2;
+    int half = (1 << (depth-1)) - 1;
+    subdivide_bezier_decasteljau(p0, p01, p012, mid, depth-1, pos);
+    pos[half] = mid;
+    subdivide_bezier_decasteljau(mid, p123, p23, p3, depth-1, pos+half+1);
+}
+
 // subdivide bezier spline into line segments (assume bezier has only bezier segments and no lines)
 // subdivide using de casteljau algorithm
+// each segment is subdivided depth first, so only the points of the final level are stored;
+// segment end points are stored first (shared between consecutive segments, while inner control
+// points are dropped), then each segment writes its interior points in its own block, so all
+// arrays are presized and segments are processed in parallel
 void subdivide_bezier_decasteljau(Mesh *bezier) {
-    auto pos = bezier->pos;
-    auto splines = bezier->spline;
-    put_your_code_here("Implement de Casteljau algorithm");
-    
-    // *note*: this psuedocode is for an iterative implementation of the algorithm without adaptive subd
-    // foreach level
-        // make new arrays of positions and bezier segments
-        // copy all the vertices into the new array (this waste space but it is easier for now)
-        // foreach bezier segment
-            // apply subdivision algorithm
-            // prepare indices for two new segments
-            // add mid point
-            // add points for first segment and fix segment indices
-            // add points for second segment and fix segment indices
-            // add indices for both segments into new segments array
-        // set new arrays pos, segments into the working lineset
-    vector<vec3f> tempPos;
-    vector<vec4i> tempSpl;
-    for(int i = 0 ; i < bezier->subdivision_bezier_level ; ++i){
-        tempPos.clear();
-        tempSpl.clear();
-        for(int j = 0 ; j < splines.size() ; ++j){
-            vec3f point1 = (pos[splines[j].x] + pos[splines[j].y])/2;
-            vec3f point2 = (pos[splines[j].y] + pos[splines[j].z])/2;
-            vec3f point3 = (pos[splines[j].z] + pos[splines[j].w])/2;
-            vec3f point12 = (point1 + point2)/2;
-            vec3f point23 = (point2 + point3)/2;
-            vec3f point13 = (point12+point23)/2;
-            if(!(tempPos.size() != 0 && tempPos[tempPos.size()-1] == pos[splines[j].x]))
-               tempPos.push_back(pos[splines[j].x]);
-            tempSpl.push_back(vec4i(tempPos.size()-1  ,tempPos.size(),tempPos.size()+1,tempPos.size()+2));
-            tempSpl.push_back(vec4i(tempPos.size()+2,tempPos.size()+3,tempPos.size()+4,tempPos.size()+5));
-            tempPos.push_back(point1);
-            tempPos.push_back(point12);
-            tempPos.push_back(point13);
-            tempPos.push_back(point23);
-            tempPos.push_back(point3);
-            tempPos.push_back(pos[splines[j].w]);
-        }
-        pos = tempPos;
-        splines = tempSpl;
+    int level = bezier->subdivision_bezier_level;
+    int nsplines = bezier->spline.size();
+    int interior = (1 << level) - 1;
+    
+    // new index of each segment end point, in order of first use
+    auto vertex = vector<int>(bezier->pos.size(), -1);
+    auto nends = 0;
+    for(auto spline : bezier->spline) {
+        if(vertex[spline.x] < 0) vertex[spline.x] = nends++;
+        if(vertex[spline.w] < 0) vertex[spline.w] = nends++;
     }
+    
+    // make arrays of the final size, starting with the end points
+    auto pos = vector<vec3f>(nends + nsplines*interior);
+    auto line = vector<vec2i>(nsplines*(interior+1));
+    for(auto i : range(bezier->pos.size())) if(vertex[i] >= 0) pos[vertex[i]] = bezier->pos[i];
+    
+    // foreach bezier segment
+        // write its interior points
+        // connect end points and interior points in order with line segments
+    parallel_for(nsplines, [&](int i) {
+        auto spline = bezier->spline[i];
+        int first = nends + i*interior;
+        subdivide_bezier_decasteljau(bezier->pos[spline.x], bezier->pos[spline.y], bezier->pos[spline.z], bezier->pos[spline.w], level, pos.data()+first);
+        auto prev = vertex[spline.x];
+        for(auto j : range(interior)) { line[i*(interior+1)+j] = {prev,first+j}; prev = first+j; }
+        line[i*(interior+1)+interior] = {prev,vertex[spline.w]};
+    });
 
-    // copy vertex positions
-    bezier->pos = pos;
+    // set new arrays
+    bezier->pos = std::move(pos);
+    bezier->line = std::move(line);
+    
+    // clear bezier array from lines
+    bezier->spline.clear();
+    bezier->subdivision_bezier_level = 0;
+    
+    // run smoothing to get proper tangents
+    smooth_tangents(bezier);
+}
+
+// distance of p from the segment ab
+float dist_segment(const vec3f& p, const vec3f& a, const vec3f& b) {
+    auto ab = b - a;
+    auto l2 = lengthSqr(ab);
+    if(l2 == 0) return dist(p,a);
+    return dist(p, a + ab * clamp(dot(p-a,ab)/l2,0.0f,1.0f));
+}
+
+// add to pos the interior points of the adaptive de casteljau subdivision of the cubic segment p0..p3
+// a segment is split until both inner control points are within tolerance of the chord p0-p3,
+// or depth more splits are reached
+void subdivide_bezier_adaptive(const vec3f& p0, const vec3f& p1, const vec3f& p2, const vec3f& p3, int depth, float tolerance, vector<vec3f>& pos) {
+    if(not depth) return;
+    if(dist_segment(p1,p0,p3) <= tolerance and dist_segment(p2,p0,p3) <= tolerance) return;
+    auto p01 = (p0 + p1)/2, p12 = (p1 + p2)/2, p23 = (p2 + p3)/2;
+    auto p012 = (p01 + p12)/2, p123 = (p12 + p23)/2;
+    auto mid = (p012 + p123)/2;
+    subdivide_bezier_adaptive(p0, p01, p012, mid, depth-1, tolerance, pos);
+    pos.push_back(mid);
+    subdivide_bezier_adaptive(mid, p123, p23, p3, depth-1, tolerance, pos);
+}
+
+// subdivide bezier spline into line segments (assume bezier has only bezier segments and no lines)
+// subdivide adaptively using de casteljau algorithm, up to subdivision_bezier_level splits per segment;
+// segment end points are shared between consecutive segments
+void subdivide_bezier_adaptive(Mesh* bezier) {
+    auto pos = vector<vec3f>();
+    auto line = vector<vec2i>();
     
-    // copy bezier segments into line segments
-    bezier->line.clear();
-    for(auto spline : splines) bezier->line.push_back({spline.x,spline.w});
+    // new index of each segment end point, added once when first used
+    auto vertex = vector<int>(bezier->pos.size(), -1);
+    auto add_vertex = [&](int i) {
+        if(vertex[i] < 0) { vertex[i] = pos.size(); pos.push_back(bezier->pos[i]); }
+        return vertex[i];
+    };
+    
+    // foreach spline segment
+        // add its first end point, then its interior points, then its last end point
+        // connect the points in order with line segments
+    for(auto spline : bezier->spline) {
+        auto start = add_vertex(spline.x);
+        int interior = pos.size();
+        subdivide_bezier_adaptive(bezier->pos[spline.x], bezier->pos[spline.y], bezier->pos[spline.z], bezier->pos[spline.w],
+                                  bezier->subdivision_bezier_level, bezier->subdivision_bezier_flatness, pos);
+        int interior_end = pos.size();
+        auto end = add_vertex(spline.w);
+        auto prev = start;
+        for(auto i : range(interior,interior_end)) { line.push_back({prev,i}); prev = i; }
+        line.push_back({prev,end});
+    }
+    
+    // report the savings over uniform subdivision
+    int uniform = bezier->spline.size() << bezier->subdivision_bezier_level;
+    message("adaptive bezier subdivision: %d line segments instead of %d (%d saved)\n", (int)line.size(), uniform, uniform - (int)line.size());
+    
+    // set new arrays
+    bezier->pos = std::move(pos);
+    bezier->line = std::move(line);
     
     // clear bezier array from lines
     bezier->spline.clear();
@@ -267,7 +377,8 @@ void subdivide_bezier(Mesh* bezier) {
 
     if(not bezier->subdivision_bezier_level) return;
 
-    if(bezier->subdivision_bezier_uniform) subdivide_bezier_uniform(bezier);
+    if(bezier->subdivision_bezier_flatness > 0) subdivide_bezier_adaptive(bezier);
+    else if(bezier->subdivision_bezier_uniform) subdivide_bezier_uniform(bezier);
     else subdivide_bezier_decasteljau(bezier);
 }
 
@@ -282,104 +393,114 @@ void subdivide_catmullclark(Mesh* subdiv) {
     // allocate a working Mesh copied from the subdiv
     auto mesh = new Mesh(*subdiv);
     
+    // positions are kept in structure-of-arrays layout while subdividing, so that every
+    // pass runs on contiguous component arrays; they are converted back once at the end
+    auto cur = vec3f_soa(mesh->pos);
+    
    // foreach level
+    // every pass writes only the elements owned by its loop index, so the passes run
+    // with parallel_for and give the same result for any number of threads
     for(auto l : range(subdiv->subdivision_catmullclark_level)) {
-        // make empty pos and quad arrays
-        auto pos = vector<vec3f>();
-        auto quad = vector<vec4i>();
-        
-        // create edge_map from current mesh
-        auto edge_map = EdgeMap(mesh->triangle,mesh->quad);
+        // create topology from current mesh
+        auto topo = make_mesh_topology(mesh->triangle,mesh->quad,cur.size());
+        WARNING_IF(topo.nonmanifold_edges, "mesh has %d non-manifold edges", topo.nonmanifold_edges);
 
-        put_your_code_here("Implement Catmull-Clark Subdivision");
+        // make pos and quad arrays of the final size
+        int edgeZ = cur.size();
+        int triZ = edgeZ + topo.edge.size();
+        int quaZ = triZ + mesh->triangle.size();
+        int triQ = mesh->triangle.size()*3;
+        auto pos = vec3f_soa(quaZ + mesh->quad.size());
+        auto quad = vector<vec4i>(triQ + mesh->quad.size()*4);
         
         // linear subdivision - create vertices --------------------------------------
         // copy all vertices from the current mesh
-        // add vertices in the middle of each edge (use EdgeMap)
+        // add vertices in the middle of each edge (use topology)
         // add vertices in the middle of each triangle
         // add vertices in the middle of each quad
-        for(int i = 0 ; i < mesh->pos.size(); ++i)
-            pos.push_back(mesh->pos[i]);
-        vector<vec2i> edge = edge_map.edges();
-        int edgeZ = pos.size();
-        for(auto e : edge)
-            pos.push_back((mesh->pos[e.x]+mesh->pos[e.y])/2);
-        int triZ = pos.size();
-        for(auto tri : mesh->triangle)
-            pos.push_back((mesh->pos[tri.x] + mesh->pos[tri.y] + mesh->pos[tri.z])/3);
-        int quaZ = pos.size();
-        for(auto qua : mesh->quad)
-            pos.push_back((mesh->pos[qua.x] + mesh->pos[qua.y] + mesh->pos[qua.z] + mesh->pos[qua.w])/4);
+        std::copy(cur.x.begin(), cur.x.end(), pos.x.begin());
+        std::copy(cur.y.begin(), cur.y.end(), pos.y.begin());
+        std::copy(cur.z.begin(), cur.z.end(), pos.z.begin());
+        parallel_for(topo.edge.size(), [&](int i) {
+            auto e = topo.edge[i];
+            for(auto c : range(3)) pos[c][edgeZ+i] = (cur[c][e.x]+cur[c][e.y])/2;
+        });
+        parallel_for(mesh->triangle.size(), [&](int i) {
+            auto tri = mesh->triangle[i];
+            for(auto c : range(3)) pos[c][triZ+i] = (cur[c][tri.x] + cur[c][tri.y] + cur[c][tri.z])/3;
+        });
+        parallel_for(mesh->quad.size(), [&](int i) {
+            auto qua = mesh->quad[i];
+            for(auto c : range(3)) pos[c][quaZ+i] = (cur[c][qua.x] + cur[c][qua.y] + cur[c][qua.z] + cur[c][qua.w])/4;
+        });
 
         // subdivision pass ----------------------------------------------------------
-        // compute an offset for the edge vertices
-        // compute an offset for the triangle vertices
-        // compute an offset for the quad vertices
         // foreach triangle
             // add three quads to the new quad array
         // foreach quad
             // add four quads to the new quad array
-        int i = 0;
-        for(auto tri : mesh->triangle){
-            int edgeM1 = edgeZ + edge_map.edge_index(vec2i(tri.x,tri.y)),
-                    edgeM2 = edgeZ + edge_map.edge_index(vec2i(tri.y,tri.z)),
-                        edgeM3 = edgeZ + edge_map.edge_index(vec2i(tri.z,tri.x));
+        parallel_for(mesh->triangle.size(), [&](int i) {
+            auto tri = mesh->triangle[i];
+            int edgeM1 = edgeZ + topo.triangle_edge[i].x,
+                    edgeM2 = edgeZ + topo.triangle_edge[i].y,
+                        edgeM3 = edgeZ + topo.triangle_edge[i].z;
             int cert = triZ + i;
-            ++i;
-            quad.push_back(vec4i(tri.x,edgeM1,cert,edgeM3));
-            quad.push_back(vec4i(tri.y,edgeM2,cert,edgeM1));
-            quad.push_back(vec4i(tri.z,edgeM3,cert,edgeM2));
-        }
-        i = 0;
-        for(auto qua : mesh->quad){
-            int edgeM1 = edgeZ + edge_map.edge_index(vec2i(qua.x,qua.y)),
-                    edgeM2 = edgeZ + edge_map.edge_index(vec2i(qua.y,qua.z)),
-                        edgeM3 = edgeZ + edge_map.edge_index(vec2i(qua.z,qua.w)),
-                            edgeM4 = edgeZ + edge_map.edge_index(vec2i(qua.w,qua.x));
+            quad[i*3+0] = vec4i(tri.x,edgeM1,cert,edgeM3);
+            quad[i*3+1] = vec4i(tri.y,edgeM2,cert,edgeM1);
+            quad[i*3+2] = vec4i(tri.z,edgeM3,cert,edgeM2);
+        });
+        parallel_for(mesh->quad.size(), [&](int i) {
+            auto qua = mesh->quad[i];
+            int edgeM1 = edgeZ + topo.quad_edge[i].x,
+                    edgeM2 = edgeZ + topo.quad_edge[i].y,
+                        edgeM3 = edgeZ + topo.quad_edge[i].z,
+                            edgeM4 = edgeZ + topo.quad_edge[i].w;
             int cert = quaZ + i;
-            ++i;
-            quad.push_back(vec4i(qua.x,edgeM1,cert,edgeM4));
-            quad.push_back(vec4i(qua.y,edgeM2,cert,edgeM1));
-            quad.push_back(vec4i(qua.z,edgeM3,cert,edgeM2));
-            quad.push_back(vec4i(qua.w,edgeM4,cert,edgeM3));
-        }
+            quad[triQ+i*4+0] = vec4i(qua.x,edgeM1,cert,edgeM4);
+            quad[triQ+i*4+1] = vec4i(qua.y,edgeM2,cert,edgeM1);
+            quad[triQ+i*4+2] = vec4i(qua.z,edgeM3,cert,edgeM2);
+            quad[triQ+i*4+3] = vec4i(qua.w,edgeM4,cert,edgeM3);
+        });
 
         // averaging pass ------------------------------------------------------------
-        // create arrays to compute pos averages (avg_pos, avg_count)
-        // arrays have the same length as the new pos array, and are init to zero
-        // for each new quad
-            // compute quad center using the new pos array
-            // foreach vertex index in the quad
-                // accumulate face center to the avg_pos and add 1 to avg_count
+        // compute the center of each new quad
+        // foreach vertex, gather the centers of its quads (in quad order) into avg_pos
         // normalize avg_pos with its count avg_count
+        auto center = vec3f_soa(quad.size());
+        parallel_for(quad.size(), [&](int i) {
+            auto qua = quad[i];
+            for(auto c : range(3)) center[c][i] = (pos[c][qua.x] + pos[c][qua.y] + pos[c][qua.z] + pos[c][qua.w]) /4.0f;
+        });
+        vector<int> vert_face_offset, vert_face;
+        make_vert_face(vector<vec3i>(), quad, pos.size(), vert_face_offset, vert_face);
         vector<int> count(pos.size(),0);
-        vector<vec3f> avePoint(pos.size(),vec3f(0,0,0));
-        for(auto qua : quad){
-              vec3f newPoint = (pos[qua.x] + pos[qua.y] + pos[qua.z] + pos[qua.w]) /4.0;
-
-            avePoint[qua.x] += newPoint;
-            ++count[qua.x];
-            avePoint[qua.y] += newPoint;
-            ++count[qua.y];
-            avePoint[qua.z] += newPoint;
-            ++count[qua.z];
-            avePoint[qua.w] += newPoint;
-            ++count[qua.w];
-        }
-        for(int i = 0 ; i < avePoint.size() ; ++i)
-            avePoint[i] /= count[i];
+        auto avePoint = vec3f_soa(pos.size());
+        parallel_for(pos.size(), [&](int i) {
+            count[i] = vert_face_offset[i+1] - vert_face_offset[i];
+            for(auto c : range(3)) {
+                auto ave = 0.0f;
+                for(auto k : range(vert_face_offset[i],vert_face_offset[i+1])) ave += center[c][vert_face[k]];
+                avePoint[c][i] = ave / count[i];
+            }
+        });
 
-//        // correction pass -----------------------------------------------------------
-//        // foreach pos, compute correction p = p + (avg_p - p) * (4/avg_count)
-        for(int i = 0 ; i < pos.size() ; ++i)
-            pos[i] = pos[i] + (avePoint[i] - pos[i]) * (4.0/count[i]);
+        // correction pass -----------------------------------------------------------
+        // foreach pos, compute correction p = p + (avg_p - p) * (4/avg_count)
+        parallel_for(pos.size(), [&](int i) {
+            auto w = float(4.0/count[i]);
+            for(auto c : range(3)) pos[c][i] = pos[c][i] + (avePoint[c][i] - pos[c][i]) * w;
+        });
 
         // set new arrays pos, quad back into the working mesh; clear triangle array
-        mesh->pos = pos;
+        cur = std::move(pos);
         mesh->triangle = vector<vec3i>();
-        mesh->quad = quad;
+        mesh->quad = std::move(quad);
     }
     
+    // back to the interleaved layout; faces changed, drop the topology copied from subdiv
+    mesh->pos = cur.aos();
+    mesh_topology_clear(mesh);
+    
     // clear subdivision
     mesh->subdivision_catmullclark_level = 0;
     
@@ -394,6 +515,9 @@ void subdivide_catmullclark(Mesh* subdiv) {
     delete mesh;
 }
 
+// tessellate a surface into its display mesh, with analytic normals and texcoords
+// (the quad is flat with normal z; smooth spheres use their radial direction as normal,
+// while faceted spheres get their normals from facet_normals)
 void subdivide_surface(Surface* surface) {
     // create mesh struct
     auto mesh    = new Mesh{};
@@ -405,13 +529,13 @@ void subdivide_surface(Surface* surface) {
     // get surface radius
     auto radius  = surface->radius;
     
-    // vertexidx is used to look up index of vertex corresponding to (i,j)
-    map<pair<int,int>,int> vertexidx;
-    
+    // vertex and face indices are computed in closed form, so all arrays are presized
+    // and rows are generated in parallel (grain chosen to give threads about 4096 vertices each)
     if(surface->isquad) {
         // compute how much to subdivide
         auto ci = 1 << surface->subdivision_level;
         auto cj = 1 << surface->subdivision_level;
+        auto grain = max(1, 4096/(cj+1));
         
         // compute corners of quad
         auto p00 = vec3f(-1,-1,0) * radius;
@@ -419,79 +543,88 @@ void subdivide_surface(Surface* surface) {
         auto p10 = vec3f( 1,-1,0) * radius;
         auto p11 = vec3f( 1, 1,0) * radius;
         
+        // vertex (i,j) is at index i*(cj+1)+j
+        auto vid = [cj](int i, int j) { return i*(cj+1)+j; };
+        mesh->pos.resize((ci+1)*(cj+1));
+        mesh->norm.assign((ci+1)*(cj+1), z3f);
+        mesh->texcoord.resize((ci+1)*(cj+1));
+        mesh->quad.resize(ci*cj);
+        
         // foreach column
-        for(auto i : range(ci+1)) {
+        parallel_for(ci+1, [&](int i) {
             // foreach row
             for(auto j : range(cj+1)) {
                 // compute u,v corresponding to column and row
                 auto u = i / (float)ci;
                 auto v = j / (float)cj;
                 
-                // compute new point location
-                auto p = p00*u*v + p01*u*(1-v) + p10*(1-u)*v + p11*(1-u)*(1-v);
-                
-                // insert point into pos vector, remembering its index
-                vertexidx[make_pair(i,j)] = mesh->pos.size();
-                mesh->pos.push_back(p);
-                mesh->norm.push_back(z3f);
+                // compute new point location and texcoord
+                // (the point is at (1-2u,1-2v)*radius, so the texcoord runs along +x and +y as seen from +z)
+                mesh->pos[vid(i,j)] = p00*u*v + p01*u*(1-v) + p10*(1-u)*v + p11*(1-u)*(1-v);
+                mesh->texcoord[vid(i,j)] = vec2f(1-u,1-v);
             }
-        }
+        }, grain);
         
         // foreach column
-        for(auto i : range(ci)) {
-            // foreach row
-            for(auto j : range(cj)) {
-                // find indices of neigboring vertices
-                int idx0 = vertexidx[make_pair(i+0,j+0)];
-                int idx1 = vertexidx[make_pair(i+1,j+0)];
-                int idx2 = vertexidx[make_pair(i+1,j+1)];
-                int idx3 = vertexidx[make_pair(i+0,j+1)];
-                
-                // create quad
-                mesh->quad.push_back({idx0, idx1, idx2, idx3});
-            }
-        }
+        parallel_for(ci, [&](int i) {
+            // foreach row, create quad
+            for(auto j : range(cj)) mesh->quad[i*cj+j] = {vid(i+0,j+0), vid(i+1,j+0), vid(i+1,j+1), vid(i+0,j+1)};
+        }, grain);
     } else {
-        put_your_code_here("Implement sphere subdivision");
-        
         // compute how much to subdivide
         int row = 1 << (surface->subdivision_level+1), column = row*2;
-
-        mesh->pos.push_back(vec3f(0,0,radius));
-        for(int i = 1 ; i < row; ++i)
-            for(int j = 0 ; j < column ; ++j){
-                double phi = 2*pi/column * j;
-                double theta = pi/row * i;
-                vec3f point(radius * cos(phi) * sin(theta) , radius * sin(phi) * sin(theta) , radius * cos(theta));
-                mesh->pos.push_back(point);
+        auto grain = max(1, 4096/(column+1));
+        
+        // vertex (r,j), at theta = pi*r/row and phi = 2*pi*j/column, is at index r*(column+1)+j;
+        // the seam and the poles are duplicated so that each vertex has its own texcoord, whose u runs
+        // along +phi (left to right seen from outside) and v from the south pole (0) to the north pole (1)
+        auto vid = [column](int r, int j) { return r*(column+1)+j; };
+        mesh->pos.resize((row+1)*(column+1));
+        mesh->norm.resize((row+1)*(column+1));
+        mesh->texcoord.resize((row+1)*(column+1));
+        mesh->triangle.resize(2*column);
+        mesh->quad.resize((row-2)*column);
+        
+        // foreach column, compute phi and its sine and cosine once
+        auto cos_phi = vector<double>(column+1), sin_phi = vector<double>(column+1);
+        for(auto j : range(column+1)) {
+            double phi = 2*pi/column * j;
+            cos_phi[j] = cos(phi); sin_phi[j] = sin(phi);
+        }
+        
+        // foreach row
+            // compute theta for the row
+            // foreach column
+                // compute new point location, normal and texcoord
+                // (pole texcoords are centered on their triangle)
+        parallel_for(row+1, [&](int r) {
+            double theta = pi/row * r;
+            double cos_theta = (r == 0) ? 1 : ((r == row) ? -1 : cos(theta));
+            double sin_theta = (r == 0 or r == row) ? 0 : sin(theta);
+            for(auto j : range(column+1)) {
+                auto n = vec3f(cos_phi[j] * sin_theta, sin_phi[j] * sin_theta, cos_theta);
+                mesh->pos[vid(r,j)] = n * radius;
+                mesh->norm[vid(r,j)] = n;
+                auto u = (r == 0 or r == row) ? (j + 0.5f) / column : j / (float)column;
+                mesh->texcoord[vid(r,j)] = vec2f(u, 1 - r / (float)row);
             }
-        mesh->pos.push_back(vec3f(0,0,-radius));
-
+        }, grain);
 
-        // foreach column
-            // foreach row
-                // compute phi,theta for column and row
-                // compute new point location
-                // insert point into pos vector, remembering its index
-          for(int i = 1; i <= column ; ++i)
-             mesh->triangle.push_back(vec3i(0,i,i == column ? 1 : i+1));
-          int last = 2 + (row-1)*column -1;
-          for(int i = last - column; i < last  ; ++i){
-              mesh->triangle.push_back(vec3i(i,last,i == last-1 ? last-column : i+1));
-          }
-          for(int i = 1; i < 2 + (row-1)*column - column -1 ; ++i)
-            mesh->quad.push_back(vec4i(i, i+column, i%column == 0 ? i+1 : i+column+1, i%column == 0 ? i-column+1 : i+1));
-        // foreach column
-            // foreach row
-                // find indices of neighboring vertices
-                // create triangle (face touching pole) or quad
+        // foreach column, create the triangles touching the poles
+        for(auto j : range(column)) {
+            mesh->triangle[j] = vec3i(vid(0,j), vid(1,j), vid(1,j+1));
+            mesh->triangle[column+j] = vec3i(vid(row-1,j), vid(row,j), vid(row-1,j+1));
+        }
+        // foreach row between the pole rows but the last
+            // foreach column, create quad with the next row
+        parallel_for(row-2, [&](int r) {
+            for(auto j : range(column)) mesh->quad[r*column+j] = vec4i(vid(r+1,j), vid(r+2,j), vid(r+2,j+1), vid(r+1,j+1));
+        }, grain);
+        
+        // faceted spheres need per-face normals
+        if(not surface->subdivision_smooth) facet_normals(mesh);
     }
     
-
-    // according to smooth, either smooth_normals or facet_normals
-    if(surface->subdivision_smooth) smooth_normals(mesh);
-    else facet_normals(mesh);
-    
     // update _display_mesh of surface
     surface->_display_mesh = mesh;
 }
@@ -525,11 +658,35 @@ void displacement_mapping( Surface* surf, image3f& png )
     else facet_normals(surf->_display_mesh);
 }
 
-void subdivide(Scene* scene) {
-    for(auto mesh : scene->meshes) {
-        if(mesh->subdivision_catmullclark_level) subdivide_catmullclark(mesh);
-        if(mesh->subdivision_bezier_level) subdivide_bezier(mesh);
+// subdivide a mesh, reusing the result stored in the subdivision cache when the mesh content
+// and subdivision parameters are unchanged; cache files are named by the mesh content hash
+// instances are skipped since their shared geometry is subdivided on its own
+void subdivide_mesh(Mesh* mesh) {
+    if(mesh->geometry) return;
+    if(not mesh->subdivision_catmullclark_level and not mesh->subdivision_bezier_level) return;
+    
+    // the seed changes whenever the subdivision code or its options would give different results
+    const uint64_t cache_version = 2;
+    auto key = mesh_hash(mesh, cache_version * 16 + normals_precision);
+    char keyname[32]; sprintf(keyname, "%016llx", (unsigned long long)key);
+    auto filename = subdivision_cache + "/" + keyname + ".bmsh";
+    
+    if(subdivision_cache != "" and load_bin_mesh(filename, mesh, key)) {
+        mesh->subdivision_catmullclark_level = 0;
+        mesh->subdivision_bezier_level = 0;
+        return;
+    }
+    
+    if(mesh->subdivision_catmullclark_level) subdivide_catmullclark(mesh);
+    if(mesh->subdivision_bezier_level) subdivide_bezier(mesh);
+    
+    if(subdivision_cache != "" and not save_bin_mesh(filename, mesh, key)) {
+        message("cannot write subdivision cache %s\n", filename.c_str());
     }
+}
+
+void subdivide(Scene* scene) {
+    for(auto mesh : scene->meshes) subdivide_mesh(mesh);
     for(auto surface : scene->surfaces) {
         subdivide_surface(surface);
     }
@@ -541,15 +698,182 @@ void subdivide(Scene* scene) {
         if(doMapping)
             displacement_mapping(surface, png);
     }
+    
+    // the topology is only needed while subdividing and computing normals
+    for(auto mesh : scene->meshes) mesh_topology_clear(mesh);
+    for(auto surface : scene->surfaces) mesh_topology_clear(surface->_display_mesh);
 }
 
+// time in milliseconds of one call of func, averaged over runs calls
+template<typename Func>
+double time_ms(int runs, const Func& func) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for(auto i = 0; i < runs; i++) func();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double,std::milli>(end-start).count() / runs;
+}
 
+// facet_normals as it was before batching, kept to benchmark against: quad normals are the
+// sum of the two normalized triangle normals, so both triangles weigh the same
+void facet_normals_unweighted(Mesh* mesh) {
+    auto pos = vector<vec3f>();
+    auto norm = vector<vec3f>();
+    auto texcoord = vector<vec2f>();
+    auto triangle = vector<vec3i>();
+    auto quad = vector<vec4i>();
+    for(auto f : mesh->triangle) {
+        auto nv = (int)pos.size();
+        auto fn = normalize(cross(mesh->pos[f.y]-mesh->pos[f.x], mesh->pos[f.z]-mesh->pos[f.x]));
+        triangle.push_back({nv,nv+1,nv+2});
+        for(auto i : range(3)) {
+            pos.push_back(mesh->pos[f[i]]);
+            norm.push_back(fn);
+            if(not mesh->texcoord.empty()) texcoord.push_back(mesh->texcoord[f[i]]);
+        }
+    }
+    for(auto f : mesh->quad) {
+        auto nv = (int)pos.size();
+        auto fn = normalize(normalize(cross(mesh->pos[f.y]-mesh->pos[f.x], mesh->pos[f.z]-mesh->pos[f.x])) +
+                            normalize(cross(mesh->pos[f.z]-mesh->pos[f.x], mesh->pos[f.w]-mesh->pos[f.x])));
+        quad.push_back({nv,nv+1,nv+2,nv+3});
+        for(auto i : range(4)) {
+            pos.push_back(mesh->pos[f[i]]);
+            norm.push_back(fn);
+            if(not mesh->texcoord.empty()) texcoord.push_back(mesh->texcoord[f[i]]);
+        }
+    }
+    mesh->pos = pos;
+    mesh->norm = norm;
+    mesh->texcoord = texcoord;
+    mesh->triangle = triangle;
+    mesh->quad = quad;
+}
+
+// time facet_normals against facet_normals_unweighted on the subdivided scene meshes, and report
+// the largest angle between their normals (nonzero on non-planar quads of unequal triangles)
+void bench_facet_normals(Scene* scene, int runs) {
+    for(auto i : range(scene->meshes.size())) {
+        auto mesh = scene->meshes[i];
+        if(mesh->geometry or (mesh->triangle.empty() and mesh->quad.empty())) continue;
+        // both run on a copy of the mesh, whose cost is timed on its own
+        auto copy_ms = time_ms(runs, [&]{ auto m = *mesh; });
+        auto new_ms = time_ms(runs, [&]{ auto m = *mesh; facet_normals(&m); }) - copy_ms;
+        auto old_ms = time_ms(runs, [&]{ auto m = *mesh; facet_normals_unweighted(&m); }) - copy_ms;
+        auto a = *mesh, b = *mesh;
+        facet_normals(&a);
+        facet_normals_unweighted(&b);
+        auto max_angle = 0.0f; auto changed = 0;
+        for(auto k : range(a.norm.size())) {
+            auto angle = acos(clamp(dot(a.norm[k],b.norm[k]),-1.0f,1.0f)) * 180 / pi;
+            max_angle = max(max_angle, (float)angle);
+            if(angle > 1) changed++;
+        }
+        message("mesh %d: %d triangles, %d quads\n", i, (int)mesh->triangle.size(), (int)mesh->quad.size());
+        message("  facet_normals:            %.3f ms\n", new_ms);
+        message("  facet_normals_unweighted: %.3f ms (%.1fx)\n", old_ms, old_ms / new_ms);
+        message("  normals changed by more than 1 degree: %.1f%%, at most %.3g degrees\n",
+                100.0 * changed / max(1,(int)a.norm.size()), max_angle);
+    }
+}
+
+// edge map of the original code on std::map, which make_mesh_topology replaced (it was first
+// moved to an open-addressing table, then dropped for MeshTopology); kept to benchmark against
+struct EdgeMapStd {
+    map<pair<int,int>,int>  _edge_map;  // internal map
+    vector<vec2i>           _edge_list; // internal list to generate unique ids
+    
+    // create an edge map for a collection of triangles and quads
+    EdgeMapStd(const vector<vec3i>& triangle, const vector<vec4i>& quad) {
+        for(auto f : triangle) { _add_edge(f.x,f.y); _add_edge(f.y,f.z); _add_edge(f.z,f.x); }
+        for(auto f : quad) { _add_edge(f.x,f.y); _add_edge(f.y,f.z); _add_edge(f.z,f.w); _add_edge(f.w,f.x); }
+    }
+    
+    // internal function to add an edge
+    void _add_edge(int i, int j) {
+        if(_edge_map.find(make_pair(i,j)) == _edge_map.end()) {
+            _edge_map[make_pair(i,j)] = _edge_list.size();
+            _edge_map[make_pair(j,i)] = _edge_list.size();
+            _edge_list.push_back(vec2i(i,j));
+        }
+    }
+    
+    // get an edge from two vertices
+    int edge_index(vec2i e) const { return _edge_map.find(make_pair(e.x, e.y))->second; }
+};
+
+// time building the edges of quad grids of increasing size and looking up the edges of every
+// quad, with EdgeMapStd against make_mesh_topology (whose lookups are the quad_edge table)
+void bench_topology(int runs) {
+    for(auto level : { 4, 6, 8, 10 }) {
+        auto surface = Surface();
+        surface.isquad = true;
+        surface.subdivision_level = level;
+        subdivide_surface(&surface);
+        auto mesh = surface._display_mesh;
+        auto nverts = (int)mesh->pos.size();
+        
+        auto map_build_ms = time_ms(runs, [&]{ auto edge_map = EdgeMapStd(mesh->triangle, mesh->quad); });
+        auto topo_build_ms = time_ms(runs, [&]{ auto topo = make_mesh_topology(mesh->triangle, mesh->quad, nverts); });
+        
+        auto edge_map = EdgeMapStd(mesh->triangle, mesh->quad);
+        auto topo = make_mesh_topology(mesh->triangle, mesh->quad, nverts);
+        error_if_not(edge_map._edge_list.size() == topo.edge.size(), "edge maps differ");
+        auto sum = (long long)0;
+        auto map_lookup_ms = time_ms(runs, [&]{
+            for(auto f : mesh->quad) for(auto k : range(4)) sum += edge_map.edge_index(vec2i(f[k],f[(k+1)%4]));
+        });
+        auto topo_lookup_ms = time_ms(runs, [&]{
+            for(auto i : range(mesh->quad.size())) for(auto k : range(4)) sum += topo.quad_edge[i][k];
+        });
+        auto lookups = mesh->quad.size() * 4.0;
+        
+        message("grid level %d: %d vertices, %d quads, %d edges (checksum %lld)\n", level, nverts,
+                (int)mesh->quad.size(), (int)topo.edge.size(), sum);
+        message("  build:  std::map %.3f ms, make_mesh_topology %.3f ms (%.1fx)\n",
+                map_build_ms, topo_build_ms, map_build_ms / topo_build_ms);
+        message("  lookup: std::map %.1f M/s, make_mesh_topology %.1f M/s\n",
+                lookups / map_lookup_ms / 1000, lookups / topo_lookup_ms / 1000);
+        
+        delete mesh;
+        delete surface.mat;
+    }
+}
+// time subdivide_surface on smooth quads and spheres from subdivision level 0 to max_level
+// (each run also frees the generated mesh; a first untimed run warms up the allocator)
+void bench_surfaces(int runs, int max_level) {
+    auto mat = new Material();
+    for(auto isquad : { true, false }) {
+        for(auto level : range(max_level+1)) {
+            auto surface = Surface();
+            surface.mat = mat;
+            surface.isquad = isquad;
+            surface.subdivision_level = level;
+            surface.subdivision_smooth = true;
+            auto nverts = 0;
+            auto run = [&]{
+                subdivide_surface(&surface);
+                nverts = surface._display_mesh->pos.size();
+                delete surface._display_mesh;
+            };
+            run();
+            auto ms = time_ms(runs, run);
+            message("subdivide_surface %s level %2d: %9d vertices, %10.3f ms (%.1f M vertices/s)\n",
+                    (isquad) ? "quad  " : "sphere", level, nverts, ms, nverts / ms / 1000);
+        }
+    }
+    delete mat;
+}
 
 // main function
 int main(int argc, char** argv) {    fout.open("data.txt");
     auto args = parse_cmdline(argc, argv,
         { "02_model", "view scene",
-            {  {"resolution",     "r", "image resolution", typeid(int),    true,  jsonvalue() }  },
+            {  {"resolution",     "r", "image resolution", typeid(int),    true,  jsonvalue() },
+               {"threads",        "t", "number of threads", typeid(int),   true,  jsonvalue() },
+               {"normals",        "n", "normals precision (exact, fast, approx)", typeid(string), true, jsonvalue("exact") },
+               {"cache",          "c", "subdivision cache directory", typeid(string), true, jsonvalue("") },
+               {"bench",          "b", "number of runs to time normals on the subdivided scene, mesh topology and surfaces, instead of viewing (0 to view)", typeid(int), true, jsonvalue(0) },
+               {"bench_level",    "",  "highest surface subdivision level timed by bench (a level 12 sphere takes about 7GB)", typeid(int), true, jsonvalue(12) }  },
             {  {"scene_filename", "",  "scene filename",   typeid(string), false, jsonvalue("scene.json")},
                {"image_filename", "",  "image filename",   typeid(string), true,  jsonvalue("")}  }
         });
@@ -570,6 +894,18 @@ int main(int argc, char** argv) {    fout.open("data.txt");
         args.object_element("image_filename").as_string() :
         scene_filename.substr(0,scene_filename.size()-5)+".png";
     
+    if(not args.object_element("threads").is_null()) {
+        parallel_threads() = max(1,args.object_element("threads").as_int());
+    }
+    
+    auto precision = args.object_element("normals").as_string();
+    if(precision == "exact") normals_precision = normalize_exact;
+    else if(precision == "fast") normals_precision = normalize_fast;
+    else if(precision == "approx") normals_precision = normalize_approx;
+    else error("unknown normals precision %s\n", precision.c_str());
+    
+    subdivision_cache = args.object_element("cache").as_string();
+    
     if(not args.object_element("resolution").is_null()) {
         scene->image_height = args.object_element("resolution").as_int();
         scene->image_width = scene->camera->width * scene->image_height / scene->camera->height;
@@ -577,6 +913,14 @@ int main(int argc, char** argv) {    fout.open("data.txt");
 
     subdivide(scene);
     
+    auto bench_runs = args.object_element("bench").as_int();
+    if(bench_runs > 0) {
+        bench_facet_normals(scene, bench_runs);
+        bench_topology(bench_runs);
+        bench_surfaces(bench_runs, args.object_element("bench_level").as_int());
+        return 0;
+    }
+    
     uiloop();
 }
 
@@ -591,19 +935,62 @@ int gl_program_id         = 0;  // OpenGL program handle
 int gl_vertex_shader_id   = 0;  // OpenGL vertex shader handle
 int gl_fragment_shader_id = 0;  // OpenGL fragment shader handle
 map<image3f*,int> gl_texture_id;// OpenGL texture handles
+bool gl_use_vao = false;        // whether vertex array objects are supported
+
+// locations of the program uniforms and attributes, resolved once in init_shaders
+struct GLLocations {
+    int camera_pos = -1;            // camera position
+    int camera_frame_inverse = -1;  // inverse of the camera frame
+    int camera_projection = -1;     // camera projection
+    int ambient = -1;               // scene ambient
+    int lights_num = -1;            // number of lights
+    int light_pos = -1;             // light positions (array)
+    int light_intensity = -1;       // light intensities (array)
+    int material_kd = -1;           // material kd
+    int material_ks = -1;           // material ks
+    int material_n = -1;            // material n
+    int material_kd_txt_on = -1;    // material kd texture enabled
+    int material_ks_txt_on = -1;    // material ks texture enabled
+    int material_norm_txt_on = -1;  // material norm texture enabled
+    int mesh_frame = -1;            // mesh frame
+    int vertex_pos = -1;            // vertex position attribute
+    int vertex_norm = -1;           // vertex normal attribute
+    int vertex_texcoord = -1;       // vertex texture coordinate attribute
+};
+GLLocations gl_locations;       // OpenGL program locations
+Material* gl_bound_material = nullptr; // material bound by the last mesh drawn in the frame
+const int gl_max_lights = 16;   // maximum number of lights in the shader
+
+// OpenGL buffers of a mesh geometry, created once and reused across frames
+struct GLMeshBuffers {
+    unsigned int vao = 0;           // vertex array object (0 if not supported)
+    unsigned int pos_vbo = 0;       // vertex positions
+    unsigned int norm_vbo = 0;      // vertex normals (0 if missing)
+    unsigned int texcoord_vbo = 0;  // vertex texture coordinates (0 if missing)
+    unsigned int triangle_ibo = 0;  // triangle indices, of triangles and split quads (0 if missing)
+    unsigned int line_ibo = 0;      // line segment indices, of lines and spline control polygons (0 if missing)
+    unsigned int edge_ibo = 0;      // wireframe edge indices (created on first wireframe draw)
+    int triangle_num = 0;           // number of triangles
+    int line_num = 0;               // number of line segments
+    int edge_num = -1;              // number of wireframe edges (-1 if not computed yet)
+};
+map<Mesh*,GLMeshBuffers> gl_mesh_buffers; // OpenGL buffers, by mesh geometry (shared by instances)
+int gl_draw_calls = 0;          // number of draw calls issued in the last frame
 
 bool save      = false;         // whether to start the save loop
 bool wireframe = false;         // display as wireframe
 
 void init_shaders();            // initialize the shaders
 void init_textures();           // initialize the textures
+void init_meshes();             // initialize the mesh buffers
+void clear_mesh_buffers(Mesh* mesh); // delete the mesh buffers (call after changing the mesh geometry and at exit)
 void shade();                   // render the scene with OpenGL
 void _shade_mesh(Mesh* mesh);
 void character_callback(GLFWwindow* window, unsigned int key);  // ...
                                 // glfw callback for character input
-void _bind_texture(string name_map, string name_on, image3f* txt, int pos); // ...
+void _bind_texture(int location_on, image3f* txt, int pos); // ...
                                 // utility to bind texture parameters for shaders
-                                // uses texture name, texture_on name, texture pointer and texture unit position
+                                // uses texture_on location, texture pointer and texture unit position
 
 // glfw callback for character input
 void character_callback(GLFWwindow* window, unsigned int key) {
@@ -630,13 +1017,18 @@ void uiloop() {
     
     auto ok_glew = glewInit();
     error_if_not(GLEW_OK == ok_glew, "glew init error");
+    gl_use_vao = GLEW_VERSION_3_0 or GLEW_ARB_vertex_array_object;
     
     init_shaders();
     init_textures();
+    init_meshes();
     
     auto mouse_last_x = -1.0;
     auto mouse_last_y = -1.0;
     
+    auto frame_num = 0;
+    auto frame_start = glfwGetTime();
+    
     while(not glfwWindowShouldClose(window)) {
         glfwGetFramebufferSize(window, &scene->image_width, &scene->image_height);
         scene->camera->width = (scene->camera->height * scene->image_width) / scene->image_height;
@@ -664,8 +1056,22 @@ void uiloop() {
         
         glfwSwapBuffers(window);
         glfwPollEvents();
+        
+        // report the average frame time in the window title once per second
+        frame_num++;
+        auto frame_elapsed = glfwGetTime() - frame_start;
+        if(frame_elapsed > 1) {
+            glfwSetWindowTitle(window, tostring("graphics13 | model | %.2f ms/frame | %d draws/frame",
+                                                1000*frame_elapsed/frame_num, gl_draw_calls).c_str());
+            frame_num = 0;
+            frame_start = glfwGetTime();
+        }
     }
     
+    // release the mesh buffers while the context is still current
+    for(auto mesh : scene->meshes) clear_mesh_buffers(mesh);
+    for(auto surf : scene->surfaces) clear_mesh_buffers(surf->_display_mesh);
+    
     glfwDestroyWindow(window);
     
     glfwTerminate();
@@ -714,6 +1120,32 @@ void init_shaders() {
     // check if program is valid
     error_if_glerror();
     error_if_program_not_valid(gl_program_id);
+    
+    // resolve uniform and attribute locations
+    gl_locations.camera_pos = glGetUniformLocation(gl_program_id,"camera_pos");
+    gl_locations.camera_frame_inverse = glGetUniformLocation(gl_program_id,"camera_frame_inverse");
+    gl_locations.camera_projection = glGetUniformLocation(gl_program_id,"camera_projection");
+    gl_locations.ambient = glGetUniformLocation(gl_program_id,"ambient");
+    gl_locations.lights_num = glGetUniformLocation(gl_program_id,"lights_num");
+    gl_locations.light_pos = glGetUniformLocation(gl_program_id,"light_pos");
+    gl_locations.light_intensity = glGetUniformLocation(gl_program_id,"light_intensity");
+    gl_locations.material_kd = glGetUniformLocation(gl_program_id,"material_kd");
+    gl_locations.material_ks = glGetUniformLocation(gl_program_id,"material_ks");
+    gl_locations.material_n = glGetUniformLocation(gl_program_id,"material_n");
+    gl_locations.material_kd_txt_on = glGetUniformLocation(gl_program_id,"material_kd_txt_on");
+    gl_locations.material_ks_txt_on = glGetUniformLocation(gl_program_id,"material_ks_txt_on");
+    gl_locations.material_norm_txt_on = glGetUniformLocation(gl_program_id,"material_norm_txt_on");
+    gl_locations.mesh_frame = glGetUniformLocation(gl_program_id,"mesh_frame");
+    gl_locations.vertex_pos = glGetAttribLocation(gl_program_id, "vertex_pos");
+    gl_locations.vertex_norm = glGetAttribLocation(gl_program_id, "vertex_norm");
+    gl_locations.vertex_texcoord = glGetAttribLocation(gl_program_id, "vertex_texcoord");
+    
+    // samplers use fixed texture units
+    glUseProgram(gl_program_id);
+    glUniform1i(glGetUniformLocation(gl_program_id,"material_kd_txt"), 0);
+    glUniform1i(glGetUniformLocation(gl_program_id,"material_ks_txt"), 1);
+    glUniform1i(glGetUniformLocation(gl_program_id,"material_norm_txt"), 2);
+    glUseProgram(0);
 }
 
 // initialize the textures
@@ -742,23 +1174,137 @@ void init_textures() {
     }
 }
 
+// create a buffer object holding data (0 if data is empty)
+template<typename T>
+unsigned int _make_buffer(GLenum target, const vector<T>& data) {
+    if(data.empty()) return 0;
+    unsigned int id = 0;
+    glGenBuffers(1, &id);
+    glBindBuffer(target, id);
+    glBufferData(target, data.size()*sizeof(T), data.data(), GL_STATIC_DRAW);
+    glBindBuffer(target, 0);
+    return id;
+}
+
+// set up the vertex attribute arrays from the mesh buffers
+// (recorded in the vertex array object when supported, otherwise called on every draw)
+void _bind_mesh_attributes(const GLMeshBuffers& buffers) {
+    auto vertex_pos_location = gl_locations.vertex_pos;
+    auto vertex_norm_location = gl_locations.vertex_norm;
+    auto vertex_texcoord_location = gl_locations.vertex_texcoord;
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.pos_vbo);
+    glEnableVertexAttribArray(vertex_pos_location);
+    glVertexAttribPointer(vertex_pos_location, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    if(buffers.norm_vbo) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.norm_vbo);
+        glEnableVertexAttribArray(vertex_norm_location);
+        glVertexAttribPointer(vertex_norm_location, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    } else glDisableVertexAttribArray(vertex_norm_location);
+    if(buffers.texcoord_vbo) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.texcoord_vbo);
+        glEnableVertexAttribArray(vertex_texcoord_location);
+        glVertexAttribPointer(vertex_texcoord_location, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    } else glDisableVertexAttribArray(vertex_texcoord_location);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// triangles of a mesh: its triangles followed by the two halves (a,b,c) and (a,c,d)
+// of each quad (a,b,c,d) (so that both are drawn in a single GL_TRIANGLES call)
+vector<vec3i> _mesh_triangles(Mesh* geom) {
+    auto triangles = geom->triangle;
+    triangles.reserve(geom->triangle.size() + geom->quad.size()*2);
+    for(auto quad : geom->quad) {
+        triangles.push_back({quad.x,quad.y,quad.z});
+        triangles.push_back({quad.x,quad.z,quad.w});
+    }
+    return triangles;
+}
+
+// line segments of a mesh: its lines followed by the control polygon of each spline
+// (so that both are drawn in a single GL_LINES call)
+vector<vec2i> _mesh_line_segments(Mesh* geom) {
+    auto segments = geom->line;
+    segments.reserve(geom->line.size() + geom->spline.size()*3);
+    for(auto spline : geom->spline) {
+        segments.push_back({spline.x,spline.y});
+        segments.push_back({spline.y,spline.z});
+        segments.push_back({spline.z,spline.w});
+    }
+    return segments;
+}
+
+// get the buffers of a mesh geometry, uploading it on first use
+GLMeshBuffers& _mesh_buffers(Mesh* geom) {
+    auto found = gl_mesh_buffers.find(geom);
+    if(found != gl_mesh_buffers.end()) return found->second;
+    auto& buffers = gl_mesh_buffers[geom];
+    buffers.pos_vbo = _make_buffer(GL_ARRAY_BUFFER, geom->pos);
+    buffers.norm_vbo = _make_buffer(GL_ARRAY_BUFFER, geom->norm);
+    buffers.texcoord_vbo = _make_buffer(GL_ARRAY_BUFFER, geom->texcoord);
+    auto triangles = _mesh_triangles(geom);
+    buffers.triangle_ibo = _make_buffer(GL_ELEMENT_ARRAY_BUFFER, triangles);
+    auto segments = _mesh_line_segments(geom);
+    buffers.line_ibo = _make_buffer(GL_ELEMENT_ARRAY_BUFFER, segments);
+    buffers.triangle_num = triangles.size();
+    buffers.line_num = segments.size();
+    if(gl_use_vao) {
+        glGenVertexArrays(1, &buffers.vao);
+        glBindVertexArray(buffers.vao);
+        _bind_mesh_attributes(buffers);
+        glBindVertexArray(0);
+    }
+    error_if_glerror();
+    return buffers;
+}
+
+// create the wireframe edge buffer of a mesh geometry on first use, from its unique edges
+void _mesh_edge_buffer(Mesh* geom, GLMeshBuffers& buffers) {
+    if(buffers.edge_num >= 0) return;
+    auto edges = make_mesh_topology(geom->triangle, geom->quad, geom->pos.size()).edge;
+    buffers.edge_ibo = _make_buffer(GL_ELEMENT_ARRAY_BUFFER, edges);
+    buffers.edge_num = edges.size();
+}
+
+// initialize the mesh buffers (after subdivision, since they hold the final geometry)
+void init_meshes() {
+    for(auto mesh : scene->meshes) _mesh_buffers(mesh_geometry(mesh));
+    for(auto surf : scene->surfaces) _mesh_buffers(surf->_display_mesh);
+}
+
+// delete the mesh buffers, that are created again when the mesh is next drawn
+// (call after changing the geometry or the faces of the mesh, and before the context is destroyed)
+void clear_mesh_buffers(Mesh* mesh) {
+    auto found = gl_mesh_buffers.find(mesh_geometry(mesh));
+    if(found == gl_mesh_buffers.end()) return;
+    auto& buffers = found->second;
+    if(buffers.vao) glDeleteVertexArrays(1, &buffers.vao);
+    unsigned int ids[] = { buffers.pos_vbo, buffers.norm_vbo, buffers.texcoord_vbo,
+        buffers.triangle_ibo, buffers.line_ibo, buffers.edge_ibo };
+    for(auto id : ids) if(id) glDeleteBuffers(1, &id);
+    gl_mesh_buffers.erase(found);
+}
+
+// draw count indices of the bound element buffer, counting the draw call
+void _draw_elements(GLenum mode, int count) {
+    glDrawElements(mode, count, GL_UNSIGNED_INT, 0);
+    gl_draw_calls++;
+}
 
 // utility to bind texture parameters for shaders
-// uses texture name, texture_on name, texture pointer and texture unit position
-void _bind_texture(string name_map, string name_on, image3f* txt, int pos) {
+// uses texture_on location, texture pointer and texture unit position
+// (the sampler of each texture is bound to its unit in init_shaders)
+void _bind_texture(int location_on, image3f* txt, int pos) {
     // if txt is not null
     if(txt) {
         // set texture on boolean parameter to true
-        glUniform1i(glGetUniformLocation(gl_program_id,name_on.c_str()),GL_TRUE);
+        glUniform1i(location_on,GL_TRUE);
         // activate a texture unit at position pos
         glActiveTexture(GL_TEXTURE0+pos);
         // bind texture object to it from gl_texture_id map
         glBindTexture(GL_TEXTURE_2D, gl_texture_id[txt]);
-        // set texture parameter to the position pos
-        glUniform1i(glGetUniformLocation(gl_program_id, name_map.c_str()), pos);
     } else {
         // set texture on boolean parameter to false
-        glUniform1i(glGetUniformLocation(gl_program_id,name_on.c_str()),GL_FALSE);
+        glUniform1i(location_on,GL_FALSE);
         // activate a texture unit at position pos
         glActiveTexture(GL_TEXTURE0+pos);
         // set zero as the texture id
@@ -788,30 +1334,35 @@ void shade() {
     
     // bind camera's position, inverse of frame and projection
     // use frame_to_matrix_inverse and frustum_matrix
-    glUniform3fv(glGetUniformLocation(gl_program_id,"camera_pos"),
+    glUniform3fv(gl_locations.camera_pos,
                  1, &scene->camera->frame.o.x);
-    glUniformMatrix4fv(glGetUniformLocation(gl_program_id,"camera_frame_inverse"),
+    glUniformMatrix4fv(gl_locations.camera_frame_inverse,
                        1, true, &frame_to_matrix_inverse(scene->camera->frame)[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(gl_program_id,"camera_projection"),
+    glUniformMatrix4fv(gl_locations.camera_projection,
                        1, true, &frustum_matrix(-scene->camera->dist*scene->camera->width/2, scene->camera->dist*scene->camera->width/2,
                                                 -scene->camera->dist*scene->camera->height/2, scene->camera->dist*scene->camera->height/2,
                                                 scene->camera->dist,10000)[0][0]);
     
     // bind ambient and number of lights
-    glUniform3fv(glGetUniformLocation(gl_program_id,"ambient"),1,&scene->ambient.x);
-    glUniform1i(glGetUniformLocation(gl_program_id,"lights_num"),scene->lights.size());
+    auto lights_num = min((int)scene->lights.size(), gl_max_lights);
+    glUniform3fv(gl_locations.ambient,1,&scene->ambient.x);
+    glUniform1i(gl_locations.lights_num,lights_num);
     
-    // foreach light
-    auto count = 0;
-    for(auto light : scene->lights) {
-        // bind light position and internsity (create param name with tostring)
-        glUniform3fv(glGetUniformLocation(gl_program_id,tostring("light_pos[%d]",count).c_str()),
-                     1, &light->frame.o.x);
-        glUniform3fv(glGetUniformLocation(gl_program_id,tostring("light_intensity[%d]",count).c_str()),
-                     1, &light->intensity.x);
-        count++;
+    // bind light positions and intensities, each array in one call
+    vec3f light_pos[gl_max_lights], light_intensity[gl_max_lights];
+    for(auto i : range(lights_num)) {
+        light_pos[i] = scene->lights[i]->frame.o;
+        light_intensity[i] = scene->lights[i]->intensity;
+    }
+    if(lights_num) {
+        glUniform3fv(gl_locations.light_pos, lights_num, &light_pos[0].x);
+        glUniform3fv(gl_locations.light_intensity, lights_num, &light_intensity[0].x);
     }
     
+    // material uniforms are bound again by the first mesh
+    gl_bound_material = nullptr;
+    gl_draw_calls = 0;
+    
     // foreach mesh
     for(auto mesh : scene->meshes) {
         _shade_mesh(mesh);
@@ -824,50 +1375,55 @@ void shade() {
 
 void _shade_mesh(Mesh* mesh) {
 
-    // bind material kd, ks, n
+    // bind material kd, ks, n and texture params (txt_on, sampler), unless already bound
     ERROR_IF_NOT(mesh, "mesh is null");
-    glUniform3fv(glGetUniformLocation(gl_program_id,"material_kd"),1,&mesh->mat->kd.x);
-    glUniform3fv(glGetUniformLocation(gl_program_id,"material_ks"),1,&mesh->mat->ks.x);
-    glUniform1f(glGetUniformLocation(gl_program_id,"material_n"),mesh->mat->n);
-    
-    // bind texture params (txt_on, sampler)
-    _bind_texture("material_kd_txt",   "material_kd_txt_on",   mesh->mat->kd_txt,   0);
-    _bind_texture("material_ks_txt",   "material_ks_txt_on",   mesh->mat->ks_txt,   1);
-    _bind_texture("material_norm_txt", "material_norm_txt_on", mesh->mat->norm_txt, 2);
+    if(mesh->mat != gl_bound_material) {
+        glUniform3fv(gl_locations.material_kd,1,&mesh->mat->kd.x);
+        glUniform3fv(gl_locations.material_ks,1,&mesh->mat->ks.x);
+        glUniform1f(gl_locations.material_n,mesh->mat->n);
+        _bind_texture(gl_locations.material_kd_txt_on,   mesh->mat->kd_txt,   0);
+        _bind_texture(gl_locations.material_ks_txt_on,   mesh->mat->ks_txt,   1);
+        _bind_texture(gl_locations.material_norm_txt_on, mesh->mat->norm_txt, 2);
+        gl_bound_material = mesh->mat;
+    }
     
     // bind mesh frame - use frame_to_matrix
-    glUniformMatrix4fv(glGetUniformLocation(gl_program_id,"mesh_frame"),1,true,&frame_to_matrix(mesh->frame)[0][0]);
+    glUniformMatrix4fv(gl_locations.mesh_frame,1,true,&frame_to_matrix(mesh->frame)[0][0]);
 
-    // enable vertex attributes arrays and set up pointers to the mesh data
-    auto vertex_pos_location = glGetAttribLocation(gl_program_id, "vertex_pos");
-    auto vertex_norm_location = glGetAttribLocation(gl_program_id, "vertex_norm");
-    auto vertex_texcoord_location = glGetAttribLocation(gl_program_id, "vertex_texcoord");
-    glEnableVertexAttribArray(vertex_pos_location);
-    glVertexAttribPointer(vertex_pos_location, 3, GL_FLOAT, GL_FALSE, 0, &mesh->pos[0].x);
-    glEnableVertexAttribArray(vertex_norm_location);
-    glVertexAttribPointer(vertex_norm_location, 3, GL_FLOAT, GL_FALSE, 0, &mesh->norm[0].x);
-    if(not mesh->texcoord.empty()) {
-        glEnableVertexAttribArray(vertex_texcoord_location);
-        glVertexAttribPointer(vertex_texcoord_location, 2, GL_FLOAT, GL_FALSE, 0, &mesh->texcoord[0].x);
-    }
-    else glVertexAttrib2f(vertex_texcoord_location, 0, 0);
+    // bind the mesh buffers (shared by instances)
+    auto geom = mesh_geometry(mesh);
+    auto& buffers = _mesh_buffers(geom);
+    if(wireframe) _mesh_edge_buffer(geom, buffers);
+    if(buffers.vao) glBindVertexArray(buffers.vao);
+    else _bind_mesh_attributes(buffers);
+    if(not buffers.texcoord_vbo) glVertexAttrib2f(gl_locations.vertex_texcoord, 0, 0);
     
     // draw triangles and quads
     if(not wireframe) {
-        if(mesh->triangle.size()) glDrawElements(GL_TRIANGLES, mesh->triangle.size()*3, GL_UNSIGNED_INT, &mesh->triangle[0].x);
-        if(mesh->quad.size()) glDrawElements(GL_QUADS, mesh->quad.size()*4, GL_UNSIGNED_INT, &mesh->quad[0].x);
+        if(buffers.triangle_num) {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.triangle_ibo);
+            _draw_elements(GL_TRIANGLES, buffers.triangle_num*3);
+        }
     } else {
-        auto edges = EdgeMap(mesh->triangle, mesh->quad).edges();
-        glDrawElements(GL_LINES, edges.size()*2, GL_UNSIGNED_INT, &edges[0].x);
+        if(buffers.edge_num) {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.edge_ibo);
+            _draw_elements(GL_LINES, buffers.edge_num*2);
+        }
     }
     
-    // draw line sets
-    if(not mesh->line.empty()) glDrawElements(GL_LINES, mesh->line.size()*2, GL_UNSIGNED_INT, mesh->line.data());
-    for(auto segment : mesh->spline) glDrawElements(GL_LINE_STRIP, 4, GL_UNSIGNED_INT, &segment);
+    // draw line sets and spline control polygons
+    if(buffers.line_num) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.line_ibo);
+        _draw_elements(GL_LINES, buffers.line_num*2);
+    }
     
-    // disable vertex attribute arrays
-    glDisableVertexAttribArray(vertex_pos_location);
-    glDisableVertexAttribArray(vertex_norm_location);
-    if(not mesh->texcoord.empty()) glDisableVertexAttribArray(vertex_texcoord_location);
+    // unbind the mesh buffers
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    if(buffers.vao) glBindVertexArray(0);
+    else {
+        glDisableVertexAttribArray(gl_locations.vertex_pos);
+        glDisableVertexAttribArray(gl_locations.vertex_norm);
+        glDisableVertexAttribArray(gl_locations.vertex_texcoord);
+    }
 }
 
@@ -0,0 +1,59 @@
+#include "common.h"
+#include "scene.h"
+
+#include <chrono>
+
+// time in milliseconds of one call of func, averaged over runs calls
+template<typename Func>
+double time_ms(int runs, const Func& func) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for(auto i = 0; i < runs; i++) func();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double,std::milli>(end-start).count() / runs;
+}
+
+// main function
+int main(int argc, char** argv) {
+    auto args = parse_cmdline(argc, argv,
+        { "mesh2bin", "convert json meshes to binary meshes (referenced in scenes with \"bin_mesh\")",
+            {  {"bench",          "b", "number of loads to time, comparing json and binary (0 to skip)", typeid(int), true, jsonvalue(0) }  },
+            {  {"json_filename",  "",  "json mesh filename",   typeid(string), false, jsonvalue("mesh.json")},
+               {"bin_filename",   "",  "binary mesh filename", typeid(string), true,  jsonvalue("")}  }
+        });
+
+    auto json_filename = args.object_element("json_filename").as_string();
+    auto bin_filename = (args.object_element("bin_filename").as_string() != "") ?
+        args.object_element("bin_filename").as_string() :
+        json_filename.substr(0,json_filename.rfind("."))+".bmsh";
+
+    // convert, storing the mesh hash as key
+    auto mesh = load_json_mesh(json_filename);
+    error_if_not(save_bin_mesh(bin_filename, mesh, mesh_hash(mesh)), "cannot write %s\n", bin_filename.c_str());
+    message("%s: %d vertices, %d triangles, %d quads, %d lines, %d splines\n", bin_filename.c_str(),
+            (int)mesh->pos.size(), (int)mesh->triangle.size(), (int)mesh->quad.size(),
+            (int)mesh->line.size(), (int)mesh->spline.size());
+
+    // the binary format stores the arrays only: warn about the rest, to be set where the mesh is referenced
+    auto json = load_json(json_filename);
+    for(auto& entry : json.as_object_ref()) {
+        auto& key = entry.first;
+        if(key == "material" or key == "frame" or key.substr(0,12) == "subdivision_")
+            message("warning: \"%s\" is not stored in %s (set it in the scenes that reference it)\n", key.c_str(), bin_filename.c_str());
+    }
+
+    // check the round trip (of the arrays, the only data stored)
+    auto loaded = new Mesh();
+    error_if_not(load_bin_mesh(bin_filename, loaded), "cannot read %s\n", bin_filename.c_str());
+    auto same_arrays = loaded->pos == mesh->pos and loaded->norm == mesh->norm and loaded->texcoord == mesh->texcoord and
+                       loaded->triangle == mesh->triangle and loaded->quad == mesh->quad and loaded->point == mesh->point and
+                       loaded->line == mesh->line and loaded->spline == mesh->spline;
+    error_if_not(same_arrays, "binary mesh %s differs from the json one\n", bin_filename.c_str());
+
+    // benchmark loading
+    auto runs = args.object_element("bench").as_int();
+    if(runs > 0) {
+        auto json_ms = time_ms(runs, [&]{ delete load_json_mesh(json_filename); });
+        auto bin_ms = time_ms(runs, [&]{ auto m = Mesh(); load_bin_mesh(bin_filename, &m); });
+        message("load json: %.3f ms\nload bin:  %.3f ms (%.1fx)\n", json_ms, bin_ms, json_ms / bin_ms);
+    }
+}
@@ -0,0 +1,224 @@
+#include "common.h"
+#include "scene.h"
+
+#if not defined(_WIN32) and not defined(NDEBUG)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// checks of the scene.h mesh utilities (run in the build directory, where they write temporary files)
+
+// number of failed checks
+int failures = 0;
+
+// report a failed check
+void check(bool ok, const char* what) {
+    if(ok) return;
+    message("FAILED: %s\n", what);
+    failures++;
+}
+
+// make_mesh_topology on a mixed mesh: two triangles and a quad sharing the edge 1-2,
+// which is then non-manifold, while all other edges are on the boundary
+void test_topology_mixed() {
+    auto triangle = vector<vec3i>{ {1,4,2}, {2,1,5} };
+    auto quad = vector<vec4i>{ {0,1,2,3} };
+    auto topo = make_mesh_topology(triangle, quad, 6);
+    // edges in order of first appearance, triangles first: 1-4, 4-2, 2-1, 1-5, 5-2, 0-1, 2-3, 3-0
+    check(topo.edge.size() == 8, "mixed mesh edge count");
+    check(topo.boundary_edges == 7, "mixed mesh boundary edges");
+    check(topo.nonmanifold_edges == 1, "mixed mesh non-manifold edges");
+    check(topo.triangle_edge[0] == vec3i(0,1,2) and topo.triangle_edge[1] == vec3i(2,3,4), "mixed mesh triangle edges");
+    check(topo.quad_edge[0] == vec4i(5,2,6,7), "mixed mesh quad edges");
+    check(topo.edge_face_count[2] == 3 and topo.edge_face[2] == vec2i(0,1), "mixed mesh faces of the shared edge");
+    check(topo.edge_face_count[0] == 1 and topo.edge_face[0] == vec2i(0,-1), "mixed mesh faces of a boundary edge");
+    // vertex 1 is on all faces (quad is face 2) and on edges 0, 2, 3, 5
+    auto faces = vector<int>(topo.vert_face.begin()+topo.vert_face_offset[1], topo.vert_face.begin()+topo.vert_face_offset[2]);
+    auto edges = vector<int>(topo.vert_edge.begin()+topo.vert_edge_offset[1], topo.vert_edge.begin()+topo.vert_edge_offset[2]);
+    check(faces == vector<int>({0,1,2}), "mixed mesh faces of a vertex");
+    check(edges == vector<int>({0,2,3,5}), "mixed mesh edges of a vertex");
+}
+
+// make_mesh_topology on a closed cube of quads, and its caching in mesh_topology
+void test_topology_cube() {
+    auto mesh = new Mesh();
+    mesh->pos = { {-1,-1,-1}, {1,-1,-1}, {1,1,-1}, {-1,1,-1}, {-1,-1,1}, {1,-1,1}, {1,1,1}, {-1,1,1} };
+    mesh->quad = { {0,3,2,1}, {4,5,6,7}, {0,1,5,4}, {1,2,6,5}, {2,3,7,6}, {3,0,4,7} };
+    auto topo = mesh_topology(mesh);
+    check(topo->edge.size() == 12, "cube edge count");
+    check(topo->boundary_edges == 0 and topo->nonmanifold_edges == 0, "cube is closed and manifold");
+    auto ok = true;
+    for(auto count : topo->edge_face_count) ok = ok and count == 2;
+    for(auto i : range(8)) ok = ok and topo->vert_edge_offset[i+1]-topo->vert_edge_offset[i] == 3;
+    check(ok, "cube edge and vertex valences");
+    // the topology is cached, shared by copies, and dropped by mesh_topology_clear
+    check(mesh_topology(mesh) == topo, "topology cached");
+    auto copy = *mesh;
+    check(mesh_topology(&copy) == topo, "topology shared by copies");
+    mesh_topology_clear(mesh);
+    check(not mesh->_topology and mesh_topology(&copy) == topo, "topology kept by copies when cleared");
+    delete mesh->mat;
+    delete mesh;
+}
+
+// whether two meshes have the same arrays (the data stored in binary meshes)
+bool same_arrays(const Mesh* a, const Mesh* b) {
+    return a->pos == b->pos and a->norm == b->norm and a->texcoord == b->texcoord and
+           a->triangle == b->triangle and a->quad == b->quad and a->point == b->point and
+           a->line == b->line and a->spline == b->spline;
+}
+
+// write the first size bytes of data to filename
+void write_bytes(const string& filename, const vector<char>& data, int size) {
+    auto f = fopen(filename.c_str(), "wb");
+    error_if_not(f, "cannot write %s\n", filename.c_str());
+    if(size) fwrite(data.data(), size, 1, f);
+    fclose(f);
+}
+
+// save_bin_mesh and load_bin_mesh round trip, and loads that must fail leaving the mesh untouched:
+// missing file, wrong key, wrong signature and files truncated anywhere
+void test_bin_mesh() {
+    auto filename = string("scene_test.bmsh");
+    auto mesh = Mesh();
+    mesh.pos = { {0,0,0}, {1,0,0}, {1,1,0}, {0,1,0}, {0.5f,0.5f,1} };
+    mesh.norm = { z3f, z3f, z3f, z3f, y3f };
+    mesh.texcoord = { {0,0}, {1,0}, {1,1}, {0,1}, {0.5f,0.5f} };
+    mesh.triangle = { {0,1,4} };
+    mesh.quad = { {0,1,2,3} };
+    mesh.point = { 4 };
+    mesh.line = { {0,4}, {1,4} };
+    mesh.spline = { {0,1,2,3} };
+    mesh.subdivision_catmullclark_level = 2;
+    check(save_bin_mesh(filename, &mesh, 42), "save_bin_mesh");
+    
+    auto loaded = Mesh(), keyed = Mesh();
+    check(load_bin_mesh(filename, &loaded) and same_arrays(&loaded, &mesh), "load_bin_mesh without key");
+    check(load_bin_mesh(filename, &keyed, 42) and same_arrays(&keyed, &mesh), "load_bin_mesh with key");
+    check(keyed.subdivision_catmullclark_level == 0, "load_bin_mesh leaves subdivision parameters");
+    
+    // failing loads leave the arrays loaded before
+    auto empty = Mesh();
+    check(not load_bin_mesh("scene_test_missing.bmsh", &loaded) and same_arrays(&loaded, &mesh), "load_bin_mesh of missing file");
+    check(not load_bin_mesh(filename, &loaded, 43) and same_arrays(&loaded, &mesh), "load_bin_mesh with wrong key");
+    auto f = fopen(filename.c_str(), "rb");
+    auto data = vector<char>(); char c;
+    while(fread(&c, 1, 1, f) == 1) data.push_back(c);
+    fclose(f);
+    auto bad = data; bad[0] = 'X';
+    write_bytes(filename, bad, bad.size());
+    check(not load_bin_mesh(filename, &loaded) and same_arrays(&loaded, &mesh), "load_bin_mesh with wrong signature");
+    auto ok = true;
+    for(auto size = 0; size < (int)data.size(); size++) {
+        write_bytes(filename, data, size);
+        ok = ok and not load_bin_mesh(filename, &loaded) and same_arrays(&loaded, &mesh);
+    }
+    check(ok, "load_bin_mesh of truncated file");
+    
+    // meshes without arrays
+    check(save_bin_mesh(filename, &empty) and load_bin_mesh(filename, &loaded) and same_arrays(&loaded, &empty), "bin mesh without arrays");
+    remove(filename.c_str());
+    delete mesh.mat; delete loaded.mat; delete keyed.mat; delete empty.mat;
+}
+
+// write text to filename
+void write_text(const string& filename, const string& text) {
+    write_bytes(filename, vector<char>(text.begin(), text.end()), text.size());
+}
+
+// jsonreader on nested objects and arrays, read both as a tree and walking them
+void test_jsonreader() {
+    auto filename = string("scene_test.json");
+    write_text(filename, "{ \"a\": [1, 2.5, -3e2], \"b\": { \"c\": [ {\"d\": true}, null, \"s\\u00e9\\n\" ], \"e\": [] },\n"
+                         "  \"f\": [1, \"x\", [2, 3]], \"g\": false }");
+    {
+        jsonreader reader(filename);
+        auto json = reader.read_value();
+        auto& a = json.object_element("a");
+        check(a.is_packed() and a.array_size() == 3 and a.number_element(1) == 2.5 and a.number_element(2) == -300, "jsonreader packed array");
+        auto& c = json.object_element("b").object_element("c");
+        check(c.is_generic_array() and c.array_size() == 3, "jsonreader generic array");
+        check(c.array_element(0).object_element("d").as_bool() and c.array_element(1).is_null(), "jsonreader values in nested array");
+        check(c.array_element(2).as_string() == "s\xc3\xa9\n", "jsonreader string escapes");
+        auto& e = json.object_element("b").object_element("e");
+        check(e.is_array() and e.array_size() == 0, "jsonreader empty array");
+        // numbers before other values are kept, in a generic array
+        auto& f = json.object_element("f");
+        check(f.is_generic_array() and f.array_size() == 3 and f.number_element(0) == 1 and
+              f.array_element(1).as_string() == "x" and f.array_element(2).is_packed(), "jsonreader mixed array");
+        check(not json.object_element("g").as_bool(), "jsonreader value after nested values");
+    }
+    {
+        jsonreader reader(filename);
+        auto keys = string(), key = string();
+        auto numbers = vector<float>();
+        reader.begin_object();
+        while(reader.next_key(key)) {
+            keys += key;
+            if(key == "a") reader.read_numbers(numbers);
+            else if(key == "b") {
+                reader.begin_object();
+                while(reader.next_key(key)) { keys += key; reader.read_value(); }
+            } else reader.read_value();
+        }
+        check(keys == "abcefg" and numbers == vector<float>({1,2.5f,-300}), "jsonreader walk of nested values");
+    }
+    remove(filename.c_str());
+}
+
+#if not defined(_WIN32) and not defined(NDEBUG)
+// whether func stops the program, as error does by asserting, running it in a child process
+template<typename Func>
+bool stops(const Func& func) {
+    fflush(stdout);
+    auto pid = fork();
+    if(pid == 0) {
+        freopen("/dev/null", "w", stdout);
+        freopen("/dev/null", "w", stderr);
+        func();
+        _exit(0);
+    }
+    auto status = 0;
+    waitpid(pid, &status, 0);
+    return not (WIFEXITED(status) and WEXITSTATUS(status) == 0);
+}
+#endif
+
+// parse a mesh from a jsonvalue tree (in scene.cpp, used for meshes not streamed by jsonreader)
+Mesh* json_parse_mesh(const jsonvalue& json);
+
+// streamed json meshes: the arrays match the ones parsed from a tree, and
+// arrays whose length is not a multiple of the vector width are rejected
+void test_json_mesh() {
+    auto filename = string("scene_test_mesh.json");
+    write_text(filename, "{ \"pos\": [0,0,0, 1,0,0, 1,1,0, 0,1,0], \"texcoord\": [0,0, 1,0, 1,1, 0,1],\n"
+                         "  \"quad\": [0,1,2,3], \"line\": [0,2], \"material\": { \"kd\": [0.5,0.25,1] },\n"
+                         "  \"subdivision_catmullclark_level\": 2 }");
+    auto mesh = load_json_mesh(filename);
+    auto parsed = json_parse_mesh(load_json(filename));
+    check(mesh->pos.size() == 4 and mesh->pos[2] == vec3f(1,1,0) and mesh->quad == vector<vec4i>({{0,1,2,3}}), "streamed mesh arrays");
+    check(same_arrays(mesh, parsed), "streamed mesh same as parsed one");
+    check(mesh->mat->kd == vec3f(0.5f,0.25f,1) and mesh->subdivision_catmullclark_level == 2, "streamed mesh values");
+    delete mesh->mat; delete mesh;
+    delete parsed->mat; delete parsed;
+    
+#if not defined(_WIN32) and not defined(NDEBUG)
+    // 10 numbers are not whole vertices, neither streamed nor in a tree
+    write_text(filename, "{ \"pos\": [0,0,0, 1,0,0, 1,1,0, 0], \"point\": [0,1,2] }");
+    check(stops([&]{ load_json_mesh(filename); }), "streamed mesh with partial vector");
+    check(stops([&]{ json_parse_mesh(load_json(filename)); }), "parsed mesh with partial vector");
+#endif
+    remove(filename.c_str());
+}
+
+// main function
+int main(int argc, char** argv) {
+    test_topology_mixed();
+    test_topology_cube();
+    test_bin_mesh();
+    test_jsonreader();
+    test_json_mesh();
+    if(failures) message("%d checks failed\n", failures);
+    else message("all checks passed\n");
+    return (failures) ? 1 : 0;
+}
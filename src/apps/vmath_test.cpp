@@ -0,0 +1,202 @@
+#include "common.h"
+#include "vmath.h"
+
+#include <chrono>
+#include <cstring>
+#include <random>
+
+// checks of the vmath.h batch functions: the simd versions must return the same bits as the
+// scalar code, which is written out here as it is compiled with VMATH_SIMD=0
+
+// whether the simd backend is on
+#if VMATH_SIMD
+const bool simd = true;
+#else
+const bool simd = false;
+#endif
+
+// number of failed checks
+int failures = 0;
+
+// report a failed check
+void check(bool ok, const char* what, int n) {
+    if(ok) return;
+    message("FAILED: %s (n = %d)\n", what, n);
+    failures++;
+}
+
+// whether two arrays of vectors have the same bits
+bool same_bits(const vector<vec3f>& a, const vector<vec3f>& b) {
+    return a.size() == b.size() and (a.empty() or memcmp((const void*)a.data(), (const void*)b.data(), a.size()*sizeof(vec3f)) == 0);
+}
+
+// random vectors with components in [-scale,scale]
+vector<vec3f> random_vectors(std::mt19937& rng, int n, float scale) {
+    auto dist = std::uniform_real_distribution<float>(-scale,scale);
+    auto v = vector<vec3f>(n);
+    for(auto& p : v) p = vec3f(dist(rng),dist(rng),dist(rng));
+    return v;
+}
+
+// random matrix with a positive last row, so that points stay away from w = 0
+mat4f random_matrix(std::mt19937& rng) {
+    auto dist = std::uniform_real_distribution<float>(-2,2);
+    auto m = mat4f();
+    for(auto i : range(16)) (&m.x.x)[i] = dist(rng);
+    m.w = vec4f(dist(rng)*0.1f,dist(rng)*0.1f,dist(rng)*0.1f,4);
+    return m;
+}
+
+// scalar mat4f * vec4f (dot of each row, as with VMATH_SIMD=0)
+vec4f scalar_mul(const mat4f& m, const vec4f& v) { return vec4f(dot(m.x,v), dot(m.y,v), dot(m.z,v), dot(m.w,v)); }
+
+// scalar mat4f * mat4f (as with VMATH_SIMD=0)
+mat4f scalar_mul(const mat4f& a, const mat4f& b) {
+    auto ret = mat4f();
+    for(auto i : range(4)) for(auto j : range(4)) {
+        auto ai = (&a.x.x)+i*4;
+        (&ret.x.x)[i*4+j] = ai[0]*(&b.x.x)[j]+ai[1]*(&b.y.x)[j]+ai[2]*(&b.z.x)[j]+ai[3]*(&b.w.x)[j];
+    }
+    return ret;
+}
+
+// scalar references of the batch functions
+vec3f scalar_transform_point(const mat4f& m, const vec3f& p) { auto tv = scalar_mul(m,vec4f(p.x,p.y,p.z,1)); return vec3f(tv.x,tv.y,tv.z) / tv.w; }
+vec3f scalar_transform_vector(const mat4f& m, const vec3f& p) { auto tv = scalar_mul(m,vec4f(p.x,p.y,p.z,0)); return vec3f(tv.x,tv.y,tv.z); }
+
+// check a batch function against its scalar reference, both out of place and in place
+template<typename Batch, typename Scalar>
+void check_batch(const char* what, const vector<vec3f>& v, const Batch& batch, const Scalar& scalar) {
+    int n = v.size();
+    auto expected = vector<vec3f>(n);
+    for(auto i : range(n)) expected[i] = scalar(v[i]);
+    auto ret = vector<vec3f>(n);
+    batch(v.data(), ret.data(), n);
+    check(same_bits(ret, expected), what, n);
+    auto inplace = v;
+    batch(inplace.data(), inplace.data(), n);
+    check(same_bits(inplace, expected), tostring("%s in place", what).c_str(), n);
+}
+
+// simd backend against the scalar code
+void test_simd() {
+    auto rng = std::mt19937(7);
+    // sizes around the simd width, so that the scalar tail is exercised
+    int sizes[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 13, 1027 };
+    for(auto n : sizes) {
+        auto v = random_vectors(rng, n, 100);
+        auto m = random_matrix(rng);
+        auto f = frame3f(); f.o = vec3f(1,2,3);
+#if VMATH_SIMD
+        // deinterleaving four vectors and interleaving them back
+        for(auto i = 0; i+4 <= n; i += 4) {
+            __m128 x, y, z; _simd_load4(v.data()+i, x, y, z);
+            float c[3][4]; _mm_storeu_ps(c[0], x); _mm_storeu_ps(c[1], y); _mm_storeu_ps(c[2], z);
+            auto ok = true;
+            for(auto k : range(4)) ok = ok and c[0][k] == v[i+k].x and c[1][k] == v[i+k].y and c[2][k] == v[i+k].z;
+            check(ok, "_simd_load4", n);
+            vec3f out[4]; _simd_store4(out, x, y, z);
+            check(memcmp((const void*)out, (const void*)(v.data()+i), sizeof(out)) == 0, "_simd_store4", n);
+        }
+#endif
+        check_batch("normalize_batch", v, [&](const vec3f* a, vec3f* r, int k){ normalize_batch(a, r, k); }, [&](const vec3f& p){ return normalize(p); });
+        check_batch("transform_point_batch(mat4f)", v, [&](const vec3f* a, vec3f* r, int k){ transform_point_batch(m, a, r, k); }, [&](const vec3f& p){ return scalar_transform_point(m,p); });
+        check_batch("transform_vector_batch(mat4f)", v, [&](const vec3f* a, vec3f* r, int k){ transform_vector_batch(m, a, r, k); }, [&](const vec3f& p){ return scalar_transform_vector(m,p); });
+        check_batch("transform_point_batch(frame3f)", v, [&](const vec3f* a, vec3f* r, int k){ transform_point_batch(f, a, r, k); }, [&](const vec3f& p){ return transform_point(f,p); });
+        check_batch("transform_vector_batch(frame3f)", v, [&](const vec3f* a, vec3f* r, int k){ transform_vector_batch(f, a, r, k); }, [&](const vec3f& p){ return transform_vector(f,p); });
+    }
+    // single element mat4f operations
+    for(auto i : range(1000)) {
+        auto a = random_matrix(rng), b = random_matrix(rng);
+        auto p = random_vectors(rng, 1, 100)[0];
+        auto v = vec4f(p.x,p.y,p.z,1);
+        auto ab = a*b, sab = scalar_mul(a,b);
+        auto av = a*v, sav = scalar_mul(a,v);
+        check(memcmp((const void*)&ab, (const void*)&sab, sizeof(mat4f)) == 0, "mat4f * mat4f", i);
+        check(memcmp((const void*)&av, (const void*)&sav, sizeof(vec4f)) == 0, "mat4f * vec4f", i);
+    }
+}
+
+// largest component error of normalized vectors with respect to a double precision reference
+double normalize_error(const vector<vec3f>& v, const vector<vec3f>& ret) {
+    auto err = 0.0;
+    for(auto i : range(v.size())) {
+        auto x = (double)v[i].x, y = (double)v[i].y, z = (double)v[i].z;
+        auto l = std::sqrt(x*x+y*y+z*z);
+        err = std::max(err, std::max(std::fabs(ret[i].x-x/l), std::max(std::fabs(ret[i].y-y/l), std::fabs(ret[i].z-z/l))));
+    }
+    return err;
+}
+
+// precision modes of normalize_batch
+void test_normalize() {
+    auto rng = std::mt19937(11);
+    // random directions with lengths from 1e-5 to 1e5
+    auto n = 100003;
+    auto v = random_vectors(rng, n, 1);
+    auto scale = std::uniform_real_distribution<float>(-5,5);
+    for(auto& p : v) {
+        if(p == zero3f) p = x3f;
+        p = p * std::pow(10.0f,scale(rng));
+    }
+    auto exact = vector<vec3f>(n), fast = vector<vec3f>(n), approx = vector<vec3f>(n);
+    normalize_batch(v.data(), exact.data(), n, normalize_exact);
+    normalize_batch(v.data(), fast.data(), n, normalize_fast);
+    normalize_batch(v.data(), approx.data(), n, normalize_approx);
+    auto expected = vector<vec3f>(n);
+    for(auto i : range(n)) expected[i] = normalize(v[i]);
+    check(same_bits(exact, expected), "normalize_exact same as normalize()", n);
+    auto fast_error = normalize_error(v, fast), approx_error = normalize_error(v, approx);
+    message("normalize_batch relative error: fast %.2g, approx %.2g\n", fast_error, approx_error);
+    check(fast_error <= 1e-6, "normalize_fast relative error", n);
+    check(approx_error <= 4e-4, "normalize_approx relative error", n);
+
+    // zero, underflowing, denormal and overflowing squared lengths, in the simd lanes
+    vec3f special[] = { zero3f, vec3f(1e-40f,0,0), vec3f(1e-25f,1e-25f,0), vec3f(1e20f,0,0),
+                        vec3f(0,-1e-20f,0), vec3f(0,0,1e-21f), vec3f(3e19f,3e19f,3e19f), vec3f(0,0,-1e30f) };
+    // squared length denormal: zero in the approximate modes only (which need VMATH_SIMD)
+    bool denormal[] = { false, false, false, false, true, true, false, false };
+    NormalizePrecision precisions[] = { normalize_exact, normalize_fast, normalize_approx };
+    for(auto precision : precisions) {
+        vec3f ret[8];
+        normalize_batch(special, ret, 8, precision);
+        auto approximate = simd and precision != normalize_exact;
+        for(auto i : range(8)) {
+            if(denormal[i] and not approximate) check(ret[i] == normalize(special[i]), "normalize_batch of denormal squared length", i);
+            else check(ret[i] == zero3f, "normalize_batch of zero, denormal or overflowing vector", i);
+        }
+    }
+}
+
+// time in microseconds of one call of func, averaged over runs calls
+template<typename Func>
+double time_us(int runs, const Func& func) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for(auto i = 0; i < runs; i++) func();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double,std::micro>(end-start).count() / runs;
+}
+
+// throughput of normalize_batch on 10k vectors, for each precision
+void bench_normalize() {
+    auto rng = std::mt19937(13);
+    auto v = random_vectors(rng, 10000, 10);
+    auto ret = vector<vec3f>(v.size());
+    const char* names[] = { "exact", "fast", "approx" };
+    NormalizePrecision precisions[] = { normalize_exact, normalize_fast, normalize_approx };
+    for(auto i : range(3)) {
+        auto us = time_us(1000, [&]{ normalize_batch(v.data(), ret.data(), v.size(), precisions[i]); });
+        message("normalize_batch %-6s: %.1f us for %d vectors\n", names[i], us, (int)v.size());
+    }
+}
+
+// main function
+int main(int argc, char** argv) {
+    message("vmath backend: %s\n", (simd) ? "sse" : "scalar");
+    test_simd();
+    test_normalize();
+    bench_normalize();
+    if(failures) message("%d checks failed\n", failures);
+    else message("all checks passed\n");
+    return (failures) ? 1 : 0;
+}
@@ -11,6 +11,7 @@
 #include <fstream>
 #include <cstdio>
 #include <typeinfo>
+#include <thread>
 
 // bringing stand libraray objects in scope
 using std::string;
@@ -59,6 +60,24 @@ struct range {
     iterator end() { return iterator(max); }
 };
 
+// number of threads used by parallel_for (defaults to the number of hardware threads)
+inline int& parallel_threads() { static int nthreads = std::thread::hardware_concurrency(); return nthreads; }
+
+// Runs func(i) for each i in [0,count), splitting the range in contiguous chunks across threads
+// func must only write data owned by index i, so that results do not depend on the number of threads
+// ranges smaller than grain run on the calling thread
+template<typename Func>
+inline void parallel_for(int count, const Func& func, int grain = 4096) {
+    auto nthreads = (count + grain - 1) / grain;
+    if(nthreads > parallel_threads()) nthreads = parallel_threads();
+    if(nthreads <= 1) { for(auto i = 0; i < count; i++) func(i); return; }
+    auto threads = vector<std::thread>();
+    auto chunk = [&func](int min, int max) { for(auto i = min; i < max; i++) func(i); };
+    for(auto t = 1; t < nthreads; t++) threads.push_back(std::thread(chunk, (int)((long long)count*t/nthreads), (int)((long long)count*(t+1)/nthreads)));
+    chunk(0, (int)((long long)count/nthreads));
+    for(auto& thread : threads) thread.join();
+}
+
 // load a text file into a buffer
 inline string load_text_file(const char* filename) {
     auto text = string("");
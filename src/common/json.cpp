@@ -8,14 +8,23 @@ static jsonvalue _to_jsonvalue(const picojson::value& pjson) {
     else if(pjson.is<double>()) return jsonvalue( pjson.get<double>() );
     else if(pjson.is<string>()) return jsonvalue( pjson.get<string>() );
     else if(pjson.is<picojson::array>()) {
+        auto& parray = pjson.get<picojson::array>();
+        auto numbers = not parray.empty();
+        for(auto& j : parray) if(not j.is<double>()) { numbers = false; break; }
+        if(numbers) {
+            auto json = jsonvalue::packed(parray.size());
+            for(auto i : range(parray.size())) json[i] = parray[i].get<double>();
+            return jsonvalue(std::move(json));
+        }
         auto json = jsonvalue::array();
+        json.reserve(pjson.get<picojson::array>().size());
         for(auto& j : pjson.get<picojson::array>()) json.push_back(_to_jsonvalue(j));
-        return jsonvalue(json);
+        return jsonvalue(std::move(json));
     }
     else if(pjson.is<picojson::object>()) {
         auto json = jsonvalue::object();
         for(auto& nj : pjson.get<picojson::object>()) json[nj.first] = _to_jsonvalue(nj.second);
-        return jsonvalue(json);
+        return jsonvalue(std::move(json));
     } else { error("unknown type"); return jsonvalue(); }
 }
 
@@ -36,6 +45,198 @@ jsonvalue load_json(const string& filename) {
     return json;
 }
 
+jsonreader::jsonreader(const string& filename) : _buffer(1 << 16) {
+    _file = fopen(filename.c_str(), "rb");
+    error_if_not(_file, "cannot open file: %s\n", filename.c_str());
+}
+
+jsonreader::~jsonreader() { if(_file) fclose(_file); }
+
+void jsonreader::_fill() {
+    _pos = 0;
+    _size = (_file) ? fread(_buffer.data(), 1, _buffer.size(), _file) : 0;
+}
+
+void jsonreader::_error(const char* msg) { error("json reading error: %s at line %d\n", msg, _line); }
+
+void jsonreader::_skip_whitespace() {
+    auto c = _peek();
+    while(c == ' ' or c == '\t' or c == '\n' or c == '\r') { _get(); c = _peek(); }
+}
+
+void jsonreader::_expect(char c) {
+    _skip_whitespace();
+    if(_peek() == c) _get();
+    else _error(tostring("expected '%c'", c).c_str());
+}
+
+void jsonreader::_expect_word(const char* word) {
+    for(auto w = word; *w; w++) {
+        if(_get() != *w) { _error(tostring("expected %s", word).c_str()); return; }
+    }
+}
+
+jsonvalue::_Type jsonreader::next_type() {
+    _skip_whitespace();
+    auto c = _peek();
+    if(c == '{') return jsonvalue::objectt;
+    if(c == '[') return jsonvalue::arrayt;
+    if(c == '"') return jsonvalue::stringt;
+    if(c == 't' or c == 'f') return jsonvalue::boolt;
+    if(c == 'n') return jsonvalue::nullt;
+    if(c == '-' or (c >= '0' and c <= '9')) return jsonvalue::doublet;
+    _error((c < 0) ? "unexpected end of file" : "unexpected character");
+    return jsonvalue::nullt;
+}
+
+void jsonreader::begin_object() { _expect('{'); _first.push_back(true); }
+
+bool jsonreader::next_key(string& key) {
+    _skip_whitespace();
+    if(_peek() == '}') { _get(); _first.pop_back(); return false; }
+    if(not _first.back()) {
+        if(_peek() != ',') { _error("expected ',' or '}'"); _first.pop_back(); return false; }
+        _get();
+    }
+    _first.back() = false;
+    _skip_whitespace();
+    if(_peek() != '"') { _error("expected key"); _first.pop_back(); return false; }
+    key = read_string();
+    _expect(':');
+    return true;
+}
+
+void jsonreader::begin_array() { _expect('['); _first.push_back(true); }
+
+bool jsonreader::next_element() {
+    _skip_whitespace();
+    if(_peek() == ']') { _get(); _first.pop_back(); return false; }
+    if(not _first.back()) {
+        if(_peek() != ',') { _error("expected ',' or ']'"); _first.pop_back(); return false; }
+        _get();
+    }
+    _first.back() = false;
+    return true;
+}
+
+void jsonreader::read_null() { _skip_whitespace(); _expect_word("null"); }
+
+bool jsonreader::read_bool() {
+    _skip_whitespace();
+    if(_peek() == 't') { _expect_word("true"); return true; }
+    _expect_word("false");
+    return false;
+}
+
+double jsonreader::read_number() {
+    _skip_whitespace();
+    char buf[64];
+    auto len = 0;
+    for(auto c = _peek(); (c >= '0' and c <= '9') or c == '-' or c == '+' or c == '.' or c == 'e' or c == 'E'; c = _peek()) {
+        if(len < 63) buf[len++] = _get();
+        else { _error("number too long"); break; }
+    }
+    buf[len] = 0;
+    char* end = nullptr;
+    auto value = strtod(buf, &end);
+    if(len == 0 or end != buf+len) _error("invalid number");
+    return value;
+}
+
+// append the utf-8 encoding of the code point c to s
+static void _append_utf8(string& s, unsigned c) {
+    if(c < 0x80) s += (char)c;
+    else if(c < 0x800) { s += (char)(0xc0 | (c >> 6)); s += (char)(0x80 | (c & 0x3f)); }
+    else if(c < 0x10000) { s += (char)(0xe0 | (c >> 12)); s += (char)(0x80 | ((c >> 6) & 0x3f)); s += (char)(0x80 | (c & 0x3f)); }
+    else { s += (char)(0xf0 | (c >> 18)); s += (char)(0x80 | ((c >> 12) & 0x3f)); s += (char)(0x80 | ((c >> 6) & 0x3f)); s += (char)(0x80 | (c & 0x3f)); }
+}
+
+string jsonreader::read_string() {
+    _expect('"');
+    auto value = string();
+    auto hex4 = [this]() {
+        auto code = 0u;
+        for(auto i = 0; i < 4; i++) {
+            auto c = _get();
+            if(c >= '0' and c <= '9') code = code*16 + (c-'0');
+            else if(c >= 'a' and c <= 'f') code = code*16 + (c-'a'+10);
+            else if(c >= 'A' and c <= 'F') code = code*16 + (c-'A'+10);
+            else { _error("invalid unicode escape"); return 0u; }
+        }
+        return code;
+    };
+    while(true) {
+        auto c = _get();
+        if(c < 0) { _error("unterminated string"); break; }
+        if(c == '"') break;
+        if(c != '\\') { value += (char)c; continue; }
+        c = _get();
+        switch(c) {
+            case '"': value += '"'; break;
+            case '\\': value += '\\'; break;
+            case '/': value += '/'; break;
+            case 'b': value += '\b'; break;
+            case 'f': value += '\f'; break;
+            case 'n': value += '\n'; break;
+            case 'r': value += '\r'; break;
+            case 't': value += '\t'; break;
+            case 'u': {
+                auto code = hex4();
+                if(code >= 0xd800 and code < 0xdc00 and _peek() == '\\') {
+                    _get(); _expect_word("u");
+                    auto low = hex4();
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                }
+                _append_utf8(value, code);
+            } break;
+            default: _error("invalid escape"); break;
+        }
+    }
+    return value;
+}
+
+jsonvalue jsonreader::read_value() {
+    switch(next_type()) {
+        case jsonvalue::nullt: read_null(); return jsonvalue();
+        case jsonvalue::boolt: return jsonvalue(read_bool());
+        case jsonvalue::doublet: return jsonvalue(read_number());
+        case jsonvalue::stringt: return jsonvalue(read_string());
+        case jsonvalue::arrayt: {
+            // numbers are read packed until an element of another type is found
+            auto numbers = jsonvalue::packed();
+            auto array = jsonvalue::array();
+            begin_array();
+            while(next_element()) {
+                if(array.empty() and next_type() == jsonvalue::doublet) { numbers.push_back(read_number()); continue; }
+                if(array.empty()) for(auto number : numbers) array.push_back(jsonvalue(number));
+                array.push_back(read_value());
+            }
+            if(array.empty() and not numbers.empty()) return jsonvalue(std::move(numbers));
+            return jsonvalue(std::move(array));
+        }
+        case jsonvalue::objectt: {
+            auto object = jsonvalue::object();
+            auto key = string();
+            begin_object();
+            while(next_key(key)) object[key] = read_value();
+            return jsonvalue(std::move(object));
+        }
+        default: return jsonvalue();
+    }
+}
+
+void jsonreader::read_numbers(vector<float>& value) {
+    value.clear();
+    begin_array();
+    while(next_element()) value.push_back((float)read_number());
+}
+
+void jsonreader::read_numbers(vector<int>& value) {
+    value.clear();
+    begin_array();
+    while(next_element()) value.push_back((int)read_number());
+}
+
 // print usage information
 static void _cmdline_print_usage(const CommandLine& cmd) {
     auto usage = "usage: " + cmd.progname;
@@ -131,7 +332,7 @@ jsonvalue parse_cmdline(const vector<string>& args, const CommandLine& cmd) {
         }
     }
     if(not largs.empty()) _cmdline_parse_error("too many arguments",cmd);
-    return jsonvalue(parsed);
+    return jsonvalue(std::move(parsed));
 }
 
 // parsing values
@@ -10,9 +10,11 @@ struct jsonvalue {
     // typedefs
     typedef vector<jsonvalue> array;
     typedef map<string,jsonvalue> object;
+    typedef vector<double> packed;
     
-    // possible types of jsonvalue
-    enum _Type { nullt, boolt, doublet, stringt, arrayt, objectt };
+    // possible types of jsonvalue (packedt is an array of numbers stored contiguously,
+    // as created by the parsers for arrays that contain only numbers)
+    enum _Type { nullt, boolt, doublet, stringt, arrayt, objectt, packedt };
     _Type _type = nullt;    // current type
     union {
         bool    _b; // bool value
@@ -20,6 +22,7 @@ struct jsonvalue {
         string* _s; // string value
         array*  _a; // generic array value
         object* _o; // object type
+        packed* _p; // packed numeric array value
     };
     
     // constructor
@@ -33,21 +36,35 @@ struct jsonvalue {
     explicit jsonvalue(const char* s) : _type(stringt), _s(new string(s)) { }
     explicit jsonvalue(const array& a) : _type(arrayt), _a(new vector<jsonvalue>(a)) { }
     explicit jsonvalue(const object& o) : _type(objectt), _o(new map<string,jsonvalue>(o)) { }
+    explicit jsonvalue(const packed& p) : _type(packedt), _p(new vector<double>(p)) { }
+    
+    // value constructors taking ownership of the contents (no deep copy)
+    explicit jsonvalue(string&& s) : _type(stringt), _s(new string(std::move(s))) { }
+    explicit jsonvalue(array&& a) : _type(arrayt), _a(new vector<jsonvalue>(std::move(a))) { }
+    explicit jsonvalue(object&& o) : _type(objectt), _o(new map<string,jsonvalue>(std::move(o))) { }
+    explicit jsonvalue(packed&& p) : _type(packedt), _p(new vector<double>(std::move(p))) { }
     
     // copy constructor
     jsonvalue(const jsonvalue& j) : _type(nullt) { set(j); }
     
+    // move constructor (steals the contents of j, leaving it null)
+    jsonvalue(jsonvalue&& j) noexcept : _type(nullt) { _move(j); }
+    
     // destuctor
     ~jsonvalue() { _clear(); }
     
     // assignment
-    jsonvalue& operator=(const jsonvalue& j) { set(j); return *this; }
+    jsonvalue& operator=(const jsonvalue& j) { if(this != &j) set(j); return *this; }
+    
+    // move assignment
+    jsonvalue& operator=(jsonvalue&& j) noexcept { if(this != &j) { _clear(); _move(j); } return *this; }
     
     // clear
     void _clear() {
         if(_type==stringt) delete _s;
         if(_type==arrayt) delete _a;
         if(_type==objectt) delete _o;
+        if(_type==packedt) delete _p;
         _type = nullt;
     }
     // set
@@ -61,17 +78,35 @@ struct jsonvalue {
             case stringt: _s = new string(*j._s); break;
             case arrayt: _a = new vector<jsonvalue>(*j._a); break;
             case objectt: _o = new map<string,jsonvalue>(*j._o); break;
+            case packedt: _p = new vector<double>(*j._p); break;
             default: error("wrong type");
         }
     }
     
+    // move: take the contents of j, leaving it null (call on a null value)
+    void _move(jsonvalue& j) {
+        _type = j._type;
+        switch(_type) {
+            case nullt: break;
+            case boolt: _b = j._b; break;
+            case doublet: _d = j._d; break;
+            case stringt: _s = j._s; break;
+            case arrayt: _a = j._a; break;
+            case objectt: _o = j._o; break;
+            case packedt: _p = j._p; break;
+        }
+        j._type = nullt;
+    }
+    
     // type checking
     bool is_null() const { return _type == nullt; }
     bool is_bool() const { return _type == boolt; }
     bool is_number() const { return _type == doublet; }
     bool is_string() const { return _type == stringt; }
-    bool is_array() const { return _type == arrayt; }
+    bool is_array() const { return _type == arrayt or _type == packedt; }
     bool is_object() const { return _type == objectt; }
+    bool is_packed() const { return _type == packedt; }
+    bool is_generic_array() const { return _type == arrayt; }
     
     // getters for values
     bool as_bool() const { error_if_not(is_bool(), "wrong type"); return _b; }
@@ -80,13 +115,17 @@ struct jsonvalue {
     double as_double() const { error_if_not(is_number(), "wrong type"); return _d; }
     string as_string() const { error_if_not(is_string(), "wrong type"); return *_s; }
     
-    // getters for arrays and objects
-    const vector<jsonvalue>& as_array_ref() const { error_if_not(is_array(), "wrong type"); return *_a; }
+    // getters for arrays and objects (as_array_ref needs a generic array, while packed arrays are read with as_packed_ref)
+    const vector<jsonvalue>& as_array_ref() const { error_if_not(is_generic_array(), "wrong type"); return *_a; }
     const map<string,jsonvalue>& as_object_ref() const { error_if_not(is_object(), "wrong type"); return *_o; }
+    const vector<double>& as_packed_ref() const { error_if_not(is_packed(), "wrong type"); return *_p; }
 
     // proprties of arrays and objects
-    int array_size() const { return as_array_ref().size(); }
-    const jsonvalue& array_element(int idx) const { error_if_not(idx >= 0 and idx < array_size(), "wrong element index"); return as_array_ref().at(idx); }
+    // (array_element needs a generic array, since packed arrays hold no jsonvalue to refer to;
+    // number_element reads numbers from either kind)
+    int array_size() const { return (is_packed()) ? _p->size() : as_array_ref().size(); }
+    const jsonvalue& array_element(int idx) const { error_if_not(is_generic_array(), "array_element of packed array, use number_element"); error_if_not(idx >= 0 and idx < array_size(), "wrong element index"); return _a->at(idx); }
+    double number_element(int idx) const { error_if_not(idx >= 0 and idx < array_size(), "wrong element index"); return (is_packed()) ? (*_p)[idx] : _a->at(idx).as_double(); }
     bool object_contains(const string& name) const { return as_object_ref().find(name) != as_object_ref().end(); }
     const jsonvalue& object_element(const string& name) const { error_if_not(object_contains(name), "wrong element name"); return as_object_ref().find(name)->second; }
 };
@@ -94,6 +133,55 @@ struct jsonvalue {
 // json loading
 jsonvalue load_json(const string& filename);
 
+// streaming json reader: parses a file incrementally, in document order, without building a
+// tree; the caller walks objects and arrays and decodes values where they are needed, so that
+// large numeric arrays can go straight into typed buffers
+struct jsonreader {
+    // constructor (opens the file) and destructor
+    jsonreader(const string& filename);
+    ~jsonreader();
+
+    // type of the next value
+    jsonvalue::_Type next_type();
+
+    // objects: call begin_object, then next_key until it returns false, reading a value after each key
+    void begin_object();
+    bool next_key(string& key);
+    // arrays: call begin_array, then next_element until it returns false, reading a value after each call
+    void begin_array();
+    bool next_element();
+
+    // values
+    void read_null();
+    bool read_bool();
+    double read_number();
+    string read_string();
+    // read the next value as a jsonvalue tree
+    jsonvalue read_value();
+    // read an array of numbers, converting each one as jsonvalue::as_float/as_int would
+    void read_numbers(vector<float>& value);
+    void read_numbers(vector<int>& value);
+
+    // implementation
+    FILE*           _file = nullptr;    // file
+    vector<char>    _buffer;            // read buffer
+    int             _pos = 0;           // read position in buffer
+    int             _size = 0;          // valid bytes in buffer
+    int             _line = 1;          // current line (for errors)
+    vector<bool>    _first;             // for each open array or object, whether no element was read yet
+
+    jsonreader(const jsonreader&) = delete;
+    jsonreader& operator=(const jsonreader&) = delete;
+
+    int _peek() { if(_pos == _size) _fill(); return (_pos < _size) ? (unsigned char)_buffer[_pos] : -1; }
+    int _get() { auto c = _peek(); if(c >= 0) _pos++; if(c == '\n') _line++; return c; }
+    void _fill();
+    void _skip_whitespace();
+    void _expect(char c);
+    void _expect_word(const char* word);
+    void _error(const char* msg);
+};
+
 // command line specification
 struct CommandLine {
     // description of command line argument
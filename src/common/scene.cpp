@@ -1,5 +1,277 @@
 #include "scene.h"
 
+#include <cstring>
+#include <mutex>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MeshTopology make_mesh_topology(const vector<vec3i>& triangle, const vector<vec4i>& quad, int nverts) {
+    auto topo = MeshTopology();
+    auto ntriangles = (int)triangle.size();
+    
+    // bucket half-edges by their smallest vertex, so that matching half-edges
+    // are found by scanning a short per-vertex list instead of a map lookup
+    auto bucket_offset = vector<int>(nverts+1,0);
+    for(auto& f : triangle) for(auto k : range(3)) bucket_offset[min(f[k],f[(k+1)%3])+1]++;
+    for(auto& f : quad) for(auto k : range(4)) bucket_offset[min(f[k],f[(k+1)%4])+1]++;
+    for(auto i : range(nverts)) bucket_offset[i+1] += bucket_offset[i];
+    auto bucket_size = vector<int>(nverts,0);
+    auto bucket_edge = vector<int>(bucket_offset[nverts]);
+    auto bucket_other = vector<int>(bucket_offset[nverts]);
+    
+    // add a half-edge of face, returning its edge index
+    topo.edge.reserve(bucket_offset[nverts]/2+1);
+    auto add_edge = [&](int face, int i, int j) {
+        auto v = min(i,j), o = max(i,j);
+        auto b = bucket_offset[v];
+        auto e = -1;
+        for(auto k : range(bucket_size[v])) if(bucket_other[b+k] == o) { e = bucket_edge[b+k]; break; }
+        if(e < 0) {
+            e = topo.edge.size();
+            topo.edge.push_back(vec2i(i,j));
+            topo.edge_face.push_back(vec2i(-1,-1));
+            topo.edge_face_count.push_back(0);
+            bucket_edge[b+bucket_size[v]] = e;
+            bucket_other[b+bucket_size[v]] = o;
+            bucket_size[v]++;
+        }
+        if(topo.edge_face_count[e] < 2) topo.edge_face[e][topo.edge_face_count[e]] = face;
+        topo.edge_face_count[e]++;
+        return e;
+    };
+    
+    // face to edge (one edge per statement, to keep ids in order of appearance)
+    topo.triangle_edge.resize(triangle.size());
+    topo.quad_edge.resize(quad.size());
+    for(auto i : range(triangle.size())) {
+        for(auto k : range(3)) topo.triangle_edge[i][k] = add_edge(i,triangle[i][k],triangle[i][(k+1)%3]);
+    }
+    for(auto i : range(quad.size())) {
+        for(auto k : range(4)) topo.quad_edge[i][k] = add_edge(ntriangles+i,quad[i][k],quad[i][(k+1)%4]);
+    }
+    
+    // boundary and non-manifold edges
+    for(auto count : topo.edge_face_count) {
+        if(count == 1) topo.boundary_edges++;
+        if(count > 2) topo.nonmanifold_edges++;
+    }
+    
+    // vertex to edge
+    topo.vert_edge_offset.assign(nverts+1,0);
+    for(auto& e : topo.edge) { topo.vert_edge_offset[e.x+1]++; topo.vert_edge_offset[e.y+1]++; }
+    for(auto i : range(nverts)) topo.vert_edge_offset[i+1] += topo.vert_edge_offset[i];
+    topo.vert_edge.resize(topo.vert_edge_offset[nverts]);
+    auto vert_fill = vector<int>(topo.vert_edge_offset.begin(),topo.vert_edge_offset.end()-1);
+    for(auto i : range(topo.edge.size())) {
+        topo.vert_edge[vert_fill[topo.edge[i].x]++] = i;
+        topo.vert_edge[vert_fill[topo.edge[i].y]++] = i;
+    }
+    
+    // vertex to face
+    make_vert_face(triangle, quad, nverts, topo.vert_face_offset, topo.vert_face);
+    
+    return topo;
+}
+
+void make_vert_face(const vector<vec3i>& triangle, const vector<vec4i>& quad, int nverts,
+                    vector<int>& vert_face_offset, vector<int>& vert_face) {
+    auto ntriangles = (int)triangle.size();
+    vert_face_offset.assign(nverts+1,0);
+    for(auto& f : triangle) for(auto k : range(3)) vert_face_offset[f[k]+1]++;
+    for(auto& f : quad) for(auto k : range(4)) vert_face_offset[f[k]+1]++;
+    for(auto i : range(nverts)) vert_face_offset[i+1] += vert_face_offset[i];
+    vert_face.resize(vert_face_offset[nverts]);
+    auto vert_fill = vector<int>(vert_face_offset.begin(),vert_face_offset.end()-1);
+    for(auto i : range(triangle.size())) for(auto k : range(3)) vert_face[vert_fill[triangle[i][k]]++] = i;
+    for(auto i : range(quad.size())) for(auto k : range(4)) vert_face[vert_fill[quad[i][k]]++] = ntriangles+i;
+}
+
+const MeshTopology* mesh_topology(Mesh* mesh) {
+    if(not mesh->_topology) mesh->_topology = std::make_shared<MeshTopology>(make_mesh_topology(mesh->triangle, mesh->quad, mesh->pos.size()));
+    return mesh->_topology.get();
+}
+
+void mesh_topology_clear(Mesh* mesh) {
+    mesh->_topology.reset();
+}
+
+// mixes size bytes of data into the hash h, eight bytes at a time
+uint64_t _hash_bytes(const void* data, size_t size, uint64_t h) {
+    auto mix = [](uint64_t h, uint64_t v) {
+        v *= 0xbf58476d1ce4e5b9ull; v ^= v >> 31;
+        h = (h ^ v) * 0x94d049bb133111ebull;
+        return h ^ (h >> 29);
+    };
+    auto bytes = (const unsigned char*)data;
+    h = mix(h, size);
+    for(; size >= 8; size -= 8, bytes += 8) { uint64_t v; memcpy(&v, bytes, 8); h = mix(h, v); }
+    if(size) { uint64_t v = 0; memcpy(&v, bytes, size); h = mix(h, v); }
+    return h;
+}
+template<typename T>
+uint64_t _hash_vector(const vector<T>& v, uint64_t h) { return _hash_bytes(v.data(), v.size()*sizeof(T), h); }
+template<typename T>
+uint64_t _hash_value(const T& v, uint64_t h) { return _hash_bytes(&v, sizeof(T), h); }
+
+uint64_t mesh_hash(const Mesh* mesh, uint64_t seed) {
+    auto h = seed;
+    h = _hash_vector(mesh->pos, h);
+    h = _hash_vector(mesh->norm, h);
+    h = _hash_vector(mesh->texcoord, h);
+    h = _hash_vector(mesh->triangle, h);
+    h = _hash_vector(mesh->quad, h);
+    h = _hash_vector(mesh->point, h);
+    h = _hash_vector(mesh->line, h);
+    h = _hash_vector(mesh->spline, h);
+    h = _hash_value(mesh->subdivision_catmullclark_level, h);
+    h = _hash_value(mesh->subdivision_catmullclark_smooth, h);
+    h = _hash_value(mesh->subdivision_bezier_level, h);
+    h = _hash_value(mesh->subdivision_bezier_uniform, h);
+    h = _hash_value(mesh->subdivision_bezier_flatness, h);
+    h = _hash_value(mesh->subdivision_normal_weighting, h);
+    return h;
+}
+
+bool save_bin_mesh(const string& filename, const Mesh* mesh, uint64_t key) {
+    auto header = BinMeshHeader();
+    header.key = key;
+    const void* data[8] = { mesh->pos.data(), mesh->norm.data(), mesh->texcoord.data(), mesh->triangle.data(),
+                            mesh->quad.data(), mesh->point.data(), mesh->line.data(), mesh->spline.data() };
+    uint64_t size[8] = { mesh->pos.size()*sizeof(vec3f), mesh->norm.size()*sizeof(vec3f), mesh->texcoord.size()*sizeof(vec2f),
+                         mesh->triangle.size()*sizeof(vec3i), mesh->quad.size()*sizeof(vec4i), mesh->point.size()*sizeof(int),
+                         mesh->line.size()*sizeof(vec2i), mesh->spline.size()*sizeof(vec4i) };
+    uint64_t count[8] = { mesh->pos.size(), mesh->norm.size(), mesh->texcoord.size(), mesh->triangle.size(),
+                          mesh->quad.size(), mesh->point.size(), mesh->line.size(), mesh->spline.size() };
+    auto offset = (uint64_t)sizeof(BinMeshHeader);
+    for(auto i : range(8)) {
+        offset = (offset + 15) & ~(uint64_t)15;
+        header.count[i] = count[i];
+        header.offset[i] = offset;
+        offset += size[i];
+    }
+    
+    // write to a temporary file, renamed when complete, so that readers never see partial files
+    auto tmpname = filename + ".tmp";
+    auto f = fopen(tmpname.c_str(), "wb");
+    if(not f) return false;
+    auto ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    const char zeros[16] = {0};
+    auto pos = (uint64_t)sizeof(header);
+    for(auto i : range(8)) {
+        if(pos < header.offset[i]) ok = ok and fwrite(zeros, header.offset[i]-pos, 1, f) == 1;
+        if(size[i]) ok = ok and fwrite(data[i], size[i], 1, f) == 1;
+        pos = header.offset[i] + size[i];
+    }
+    ok = (fclose(f) == 0) and ok;
+#ifdef _WIN32
+    if(ok) remove(filename.c_str());
+#endif
+    ok = ok and rename(tmpname.c_str(), filename.c_str()) == 0;
+    if(not ok) remove(tmpname.c_str());
+    return ok;
+}
+
+// copies count elements from data into v
+template<typename T>
+void _bin_mesh_read(vector<T>& v, const char* data, uint64_t count) {
+    v.resize(count);
+    if(count) memcpy(v.data(), data, count*sizeof(T));
+}
+
+bool load_bin_mesh(const string& filename, Mesh* mesh, uint64_t key) {
+    // map (or read) the whole file
+#ifndef _WIN32
+    auto fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 or st.st_size < (off_t)sizeof(BinMeshHeader)) { close(fd); return false; }
+    auto size = (uint64_t)st.st_size;
+    auto mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED) return false;
+    auto buffer = (const char*)mapped;
+#else
+    auto f = fopen(filename.c_str(), "rb");
+    if(not f) return false;
+    fseek(f, 0, SEEK_END);
+    auto size = (uint64_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    auto data = vector<char>(size);
+    auto read = size and fread(data.data(), size, 1, f) == 1;
+    fclose(f);
+    if(not read or size < sizeof(BinMeshHeader)) return false;
+    auto buffer = (const char*)data.data();
+#endif
+    
+    // validate header
+    auto header = BinMeshHeader();
+    auto expected = BinMeshHeader();
+    memcpy(&header, buffer, sizeof(header));
+    auto ok = memcmp(header.magic, expected.magic, 4) == 0 and header.version == expected.version and
+              (not key or header.key == key);
+    uint64_t elem_size[8] = { sizeof(vec3f), sizeof(vec3f), sizeof(vec2f), sizeof(vec3i), sizeof(vec4i), sizeof(int), sizeof(vec2i), sizeof(vec4i) };
+    for(auto i : range(8)) {
+        ok = ok and header.offset[i] <= size and header.count[i] <= (size - header.offset[i]) / elem_size[i];
+    }
+    
+    // copy arrays
+    if(ok) {
+        _bin_mesh_read(mesh->pos, buffer+header.offset[0], header.count[0]);
+        _bin_mesh_read(mesh->norm, buffer+header.offset[1], header.count[1]);
+        _bin_mesh_read(mesh->texcoord, buffer+header.offset[2], header.count[2]);
+        _bin_mesh_read(mesh->triangle, buffer+header.offset[3], header.count[3]);
+        _bin_mesh_read(mesh->quad, buffer+header.offset[4], header.count[4]);
+        _bin_mesh_read(mesh->point, buffer+header.offset[5], header.count[5]);
+        _bin_mesh_read(mesh->line, buffer+header.offset[6], header.count[6]);
+        _bin_mesh_read(mesh->spline, buffer+header.offset[7], header.count[7]);
+        mesh_topology_clear(mesh);
+    }
+    
+#ifndef _WIN32
+    munmap(mapped, size);
+#endif
+    return ok;
+}
+
+// whether two meshes have the same arrays and subdivision parameters
+bool _mesh_same_geometry(const Mesh* a, const Mesh* b) {
+    return a->pos == b->pos and a->norm == b->norm and a->texcoord == b->texcoord and
+           a->triangle == b->triangle and a->quad == b->quad and a->point == b->point and
+           a->line == b->line and a->spline == b->spline and
+           a->subdivision_catmullclark_level == b->subdivision_catmullclark_level and
+           a->subdivision_catmullclark_smooth == b->subdivision_catmullclark_smooth and
+           a->subdivision_bezier_level == b->subdivision_bezier_level and
+           a->subdivision_bezier_uniform == b->subdivision_bezier_uniform and
+           a->subdivision_bezier_flatness == b->subdivision_bezier_flatness and
+           a->subdivision_normal_weighting == b->subdivision_normal_weighting;
+}
+
+void share_mesh_geometry(Scene* scene) {
+    // group meshes by hash, confirming matches by comparing the arrays
+    auto shared = map<uint64_t,vector<Mesh*>>();
+    for(auto mesh : scene->meshes) {
+        if(mesh->geometry) continue;
+        auto& candidates = shared[mesh_hash(mesh)];
+        auto geometry = (Mesh*)nullptr;
+        for(auto candidate : candidates) if(_mesh_same_geometry(candidate, mesh)) { geometry = candidate; break; }
+        if(not geometry) { candidates.push_back(mesh); continue; }
+        mesh->geometry = geometry;
+        mesh->pos = vector<vec3f>();
+        mesh->norm = vector<vec3f>();
+        mesh->texcoord = vector<vec2f>();
+        mesh->triangle = vector<vec3i>();
+        mesh->quad = vector<vec4i>();
+        mesh->point = vector<int>();
+        mesh->line = vector<vec2i>();
+        mesh->spline = vector<vec4i>();
+        mesh_topology_clear(mesh);
+    }
+}
+
 vector<image3f*> get_textures(Scene* scene) {
     auto textures = set<image3f*>();
     for(auto mesh : scene->meshes) {
@@ -51,13 +323,20 @@ void set_view_turntable(Camera* camera, float rotate_phi, float rotate_theta, fl
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+// numeric arrays are usually packed (see jsonvalue) and converted in a single loop
 void json_set_values(const jsonvalue& json, float* value, int n) {
     error_if_not(n == json.array_size(), "incorrect array size");
-    for(auto i : range(n)) value[i] = json.array_element(i).as_float();
+    if(json.is_packed()) {
+        auto numbers = json.as_packed_ref().data();
+        for(auto i = 0; i < n; i++) value[i] = (float)numbers[i];
+    } else for(auto i : range(n)) value[i] = json.array_element(i).as_float();
 }
 void json_set_values(const jsonvalue& json, int* value, int n) {
     error_if_not(n == json.array_size(), "incorrect array size");
-    for(auto i : range(n)) value[i] = json.array_element(i).as_int();
+    if(json.is_packed()) {
+        auto numbers = json.as_packed_ref().data();
+        for(auto i = 0; i < n; i++) value[i] = (int)numbers[i];
+    } else for(auto i : range(n)) value[i] = json.array_element(i).as_int();
 }
 
 void json_set_value(const jsonvalue& json, bool& value)  { value = json.as_bool(); }
@@ -98,6 +377,13 @@ void json_set_value(const jsonvalue& json, frame3f& value) {
         value = orthonormalize_zyx(value);
     }
 }
+void json_set_value(const jsonvalue& json, NormalWeighting& value) {
+    auto name = json.as_string();
+    if(name == "uniform") value = normal_weighting_uniform;
+    else if(name == "area") value = normal_weighting_area;
+    else if(name == "angle") value = normal_weighting_angle;
+    else error("unknown normal weighting %s\n", name.c_str());
+}
 void json_set_value(const jsonvalue& json, vector<vector<mat4f>>& value) {
     value.resize(json.array_size());
     for(auto i : range(value.size())) json_set_value(json.array_element(i), value[i]);
@@ -137,8 +423,14 @@ Camera* json_parse_lookatcamera(const jsonvalue& json) {
     return lookat_camera(from, to, up, width, height, dist);
 }
 
-vector<string>          json_texture_paths;
+// directories of the files being parsed, used to resolve texture filenames
+// (per thread, since mesh files are parsed concurrently by load_json_scene)
+thread_local vector<string> json_texture_paths = { "" };
+// textures loaded in the current scene load, shared by all threads
 map<string,image3f*>    json_texture_cache;
+std::mutex              json_texture_mutex;
+// whether texture decoding is deferred to json_load_textures
+bool                    json_texture_deferred = false;
 
 void json_texture_path_push(string filename) {
     auto pos = filename.rfind("/");
@@ -147,22 +439,36 @@ void json_texture_path_push(string filename) {
 }
 void json_texture_path_pop() { json_texture_paths.pop_back(); }
 
-void json_parse_opttexture(jsonvalue json, image3f*& txt, string name) {
+// decode the texture fullname into txt
+void json_load_texture(const string& fullname, image3f* txt) {
+    auto ext = fullname.substr(fullname.size()-3);
+    if(ext == "pfm") {
+        auto image = read_pnm("models/pisa_latlong.pfm", true);
+        *txt = image.gamma(1/2.2);
+    } else if(ext == "png") {
+        *txt = read_png(fullname,true);
+    } else error("unsupported image format %s\n", ext.c_str());
+}
+
+// decode all textures of the current scene load in parallel
+// the first one is decoded alone, since lodepng builds its tables lazily on first use
+void json_load_textures() {
+    auto textures = vector<pair<string,image3f*>>(json_texture_cache.begin(), json_texture_cache.end());
+    if(textures.empty()) return;
+    json_load_texture(textures[0].first, textures[0].second);
+    parallel_for(textures.size()-1, [&textures](int i){ json_load_texture(textures[i+1].first, textures[i+1].second); }, 1);
+}
+
+void json_parse_opttexture(const jsonvalue& json, image3f*& txt, const string& name) {
     if(not json.object_contains(name)) return;
     auto filename = json.object_element(name).as_string();
     if(filename.empty()) { txt = nullptr; return; }
     auto dirname = json_texture_paths.back();
     auto fullname = dirname + filename;
+    std::lock_guard<std::mutex> lock(json_texture_mutex);
     if (json_texture_cache.find(fullname) == json_texture_cache.end()) {
-        auto ext = fullname.substr(fullname.size()-3);
-        if(ext == "pfm") {
-            auto image = read_pnm("models/pisa_latlong.pfm", true);
-            image = image.gamma(1/2.2);
-            json_texture_cache[fullname] = new image3f(image);
-        } else if(ext == "png") {
-            auto image = read_png(fullname,true);
-            json_texture_cache[fullname] = new image3f(image);
-        } else error("unsupported image format %s\n", ext.c_str());
+        json_texture_cache[fullname] = new image3f();
+        if(not json_texture_deferred) json_load_texture(fullname, json_texture_cache[fullname]);
     }
     txt = json_texture_cache[fullname];
 }
@@ -173,6 +479,11 @@ Material* json_parse_material(const jsonvalue& json) {
     json_set_optvalue(json, material->ks, "ks");
     json_set_optvalue(json, material->kr, "kr");
     json_set_optvalue(json, material->n, "n");
+    json_parse_opttexture(json, material->kd_txt, "kd_txt");
+    json_parse_opttexture(json, material->ks_txt, "ks_txt");
+    json_parse_opttexture(json, material->kr_txt, "kr_txt");
+    json_parse_opttexture(json, material->norm_txt, "norm_txt");
+    json_parse_opttexture(json, material->ke_txt, "ke_txt");
     return material;
 }
 
@@ -190,19 +501,49 @@ Surface* json_parse_surface(const jsonvalue& json) {
 
 vector<Surface*> json_parse_surfaces(const jsonvalue& json) {
     vector<Surface*> surfaces;
-    for(auto value : json.as_array_ref()) surfaces.push_back( json_parse_surface(value) );
+    for(auto& value : json.as_array_ref()) surfaces.push_back( json_parse_surface(value) );
     return surfaces;
 }
 
 
 
-Mesh* json_parse_mesh(const jsonvalue& json) {
+// mesh files loaded in the current scene load, shared by all threads
+map<string,Mesh*>       json_mesh_cache;
+std::mutex              json_mesh_mutex;
+
+// load the mesh file referenced by the "json_mesh" or "bin_mesh" value of json
+Mesh* json_load_mesh_file(const jsonvalue& json) {
+    auto binary = json.object_contains("bin_mesh");
+    auto filename = json.object_element(binary ? "bin_mesh" : "json_mesh").as_string();
+    if(not binary) return load_json_mesh(filename);
     auto mesh = new Mesh();
-    if(json.object_contains("json_mesh")) {
-        json_texture_path_push(json.object_element("json_mesh").as_string());
-        mesh = json_parse_mesh(load_json(json.object_element("json_mesh").as_string()));
-        json_texture_path_pop();
+    error_if_not(load_bin_mesh(filename, mesh), "cannot load bin mesh %s\n", filename.c_str());
+    return mesh;
+}
+
+// get the mesh file referenced by json from the cache, loading it if needed
+Mesh* json_cached_mesh_file(const jsonvalue& json) {
+    auto filename = json.object_element(json.object_contains("bin_mesh") ? "bin_mesh" : "json_mesh").as_string();
+    {
+        std::lock_guard<std::mutex> lock(json_mesh_mutex);
+        if(json_mesh_cache.find(filename) != json_mesh_cache.end()) return json_mesh_cache[filename];
     }
+    auto loaded = json_load_mesh_file(json);
+    std::lock_guard<std::mutex> lock(json_mesh_mutex);
+    if(json_mesh_cache.find(filename) != json_mesh_cache.end()) { delete loaded->mat; delete loaded; return json_mesh_cache[filename]; }
+    json_mesh_cache[filename] = loaded;
+    return loaded;
+}
+
+Mesh* json_parse_mesh(const jsonvalue& json) {
+    auto mesh = (Mesh*)nullptr;
+    if(json.object_contains("json_mesh") or json.object_contains("bin_mesh")) {
+        // each mesh file is loaded once per scene load, references copy the loaded mesh
+        // but get their own material, so that meshes can be changed and freed on their own
+        auto cached = json_cached_mesh_file(json);
+        mesh = new Mesh(*cached);
+        mesh->mat = new Material(*cached->mat);
+    } else mesh = new Mesh();
     json_set_optvalue(json, mesh->frame, "frame");
     json_set_optvalue(json, mesh->pos, "pos");
     json_set_optvalue(json, mesh->norm, "norm");
@@ -212,14 +553,116 @@ Mesh* json_parse_mesh(const jsonvalue& json) {
     json_set_optvalue(json, mesh->point, "point");
     json_set_optvalue(json, mesh->line, "line");
     json_set_optvalue(json, mesh->spline, "spline");
-    if(json.object_contains("material")) mesh->mat = json_parse_material(json.object_element("material"));
+    if(json.object_contains("material")) {
+        delete mesh->mat;
+        mesh->mat = json_parse_material(json.object_element("material"));
+    }
     json_set_optvalue(json, mesh->subdivision_catmullclark_level, "subdivision_catmullclark_level");
     json_set_optvalue(json, mesh->subdivision_catmullclark_smooth, "subdivision_catmullclark_smooth");
     json_set_optvalue(json, mesh->subdivision_bezier_level, "subdivision_bezier_level");
     json_set_optvalue(json, mesh->subdivision_bezier_uniform, "subdivision_bezier_uniform");
+    json_set_optvalue(json, mesh->subdivision_bezier_flatness, "subdivision_bezier_flatness");
+    json_set_optvalue(json, mesh->subdivision_normal_weighting, "subdivision_normal_weighting");
+    return mesh;
+}
+
+// streaming parsing of mesh files: numeric arrays are decoded directly from the file into the
+// mesh vectors, while the remaining (small) values are gathered in a jsonvalue and parsed as above
+
+template<typename T, typename C>
+void json_read_values(jsonreader& reader, vector<T>& value) {
+    auto values = vector<C>();
+    reader.read_numbers(values);
+    auto width = (int)(sizeof(T)/sizeof(C));
+    error_if_not(values.size() % width == 0, "incorrect array size");
+    value.resize(values.size() / width);
+    if(not values.empty()) memcpy((C*)value.data(), values.data(), values.size()*sizeof(C));
+}
+
+// decode the mesh array key into mesh, returning false if key is not a mesh array
+bool json_read_mesh_array(jsonreader& reader, const string& key, Mesh* mesh) {
+    if(key == "pos") json_read_values<vec3f,float>(reader, mesh->pos);
+    else if(key == "norm") json_read_values<vec3f,float>(reader, mesh->norm);
+    else if(key == "texcoord") json_read_values<vec2f,float>(reader, mesh->texcoord);
+    else if(key == "triangle") json_read_values<vec3i,int>(reader, mesh->triangle);
+    else if(key == "quad") json_read_values<vec4i,int>(reader, mesh->quad);
+    else if(key == "point") json_read_values<int,int>(reader, mesh->point);
+    else if(key == "line") json_read_values<vec2i,int>(reader, mesh->line);
+    else if(key == "spline") json_read_values<vec4i,int>(reader, mesh->spline);
+    else return false;
+    return true;
+}
+
+// values of a mesh being streamed: small values in json, streamed arrays in arrays
+struct JsonMeshValues {
+    Mesh*       mesh = nullptr;     // mesh to fill (when loading is deferred)
+    jsonvalue   json;               // small values, parsed by json_parse_mesh
+    Mesh        arrays;             // streamed arrays
+    set<string> streamed;           // names of the streamed arrays
+};
+
+// meshes referencing mesh files, whose parsing is deferred until the files are loaded
+// (only set on the thread running load_json_scene)
+thread_local vector<JsonMeshValues>* json_pending_meshes = nullptr;
+
+// fill mesh from values; the small values may reference a mesh file, that the streamed arrays override
+void json_finish_mesh(JsonMeshValues& values, Mesh* mesh) {
+    auto parsed = json_parse_mesh(values.json);
+    delete mesh->mat;
+    *mesh = std::move(*parsed);
+    delete parsed;
+    if(values.streamed.count("pos")) mesh->pos.swap(values.arrays.pos);
+    if(values.streamed.count("norm")) mesh->norm.swap(values.arrays.norm);
+    if(values.streamed.count("texcoord")) mesh->texcoord.swap(values.arrays.texcoord);
+    if(values.streamed.count("triangle")) mesh->triangle.swap(values.arrays.triangle);
+    if(values.streamed.count("quad")) mesh->quad.swap(values.arrays.quad);
+    if(values.streamed.count("point")) mesh->point.swap(values.arrays.point);
+    if(values.streamed.count("line")) mesh->line.swap(values.arrays.line);
+    if(values.streamed.count("spline")) mesh->spline.swap(values.arrays.spline);
+    delete values.arrays.mat;
+    values.arrays.mat = nullptr;
+}
+
+Mesh* json_read_mesh(jsonreader& reader) {
+    auto values = JsonMeshValues();
+    auto json = jsonvalue::object();
+    auto key = string();
+    reader.begin_object();
+    while(reader.next_key(key)) {
+        if(reader.next_type() == jsonvalue::arrayt and json_read_mesh_array(reader, key, &values.arrays)) values.streamed.insert(key);
+        else json[key] = reader.read_value();
+    }
+    auto file = json.count("json_mesh") or json.count("bin_mesh");
+    values.json = jsonvalue(std::move(json));
+    values.mesh = new Mesh();
+    if(file and json_pending_meshes) json_pending_meshes->push_back(std::move(values));
+    else json_finish_mesh(values, values.mesh);
+    return values.mesh;
+}
+
+vector<Mesh*> json_read_meshes(jsonreader& reader) {
+    auto meshes = vector<Mesh*>();
+    reader.begin_array();
+    while(reader.next_element()) meshes.push_back( json_read_mesh(reader) );
+    return meshes;
+}
+
+Mesh* load_json_mesh(const string& filename) {
+    json_texture_path_push(filename);
+    jsonreader reader(filename);
+    auto mesh = json_read_mesh(reader);
+    json_texture_path_pop();
     return mesh;
 }
 
+vector<Mesh*> load_json_meshes(const string& filename) {
+    json_texture_path_push(filename);
+    jsonreader reader(filename);
+    auto meshes = json_read_meshes(reader);
+    json_texture_path_pop();
+    return meshes;
+}
+
 vector<Mesh*> json_parse_meshes(const jsonvalue& json) {
     auto meshes = vector<Mesh*>();
     for(auto& value : json.as_array_ref())
@@ -252,9 +695,7 @@ Scene* json_parse_scene(const jsonvalue& json) {
     if(json.object_contains("surfaces")) scene->surfaces = json_parse_surfaces(json.object_element("surfaces"));
     // meshes
     if(json.object_contains("json_meshes")) {
-        json_texture_path_push(json.object_element("json_meshes").as_string());
-        scene->meshes = json_parse_meshes(load_json(json.object_element("json_meshes").as_string()));
-        json_texture_path_pop();
+        scene->meshes = load_json_meshes(json.object_element("json_meshes").as_string());
     }
     if(json.object_contains("meshes")) {
         scene->meshes = json_parse_meshes(json.object_element("meshes"));
@@ -271,12 +712,59 @@ Scene* json_parse_scene(const jsonvalue& json) {
     return scene;
 }
 
+void json_mesh_cache_clear() {
+    for(auto& entry : json_mesh_cache) { delete entry.second->mat; delete entry.second; }
+    json_mesh_cache.clear();
+}
+
+// streaming parsing of scene files: inline meshes are streamed as above, the rest is parsed as a jsonvalue
+Scene* json_read_scene(jsonreader& reader) {
+    auto json = jsonvalue::object();
+    auto meshes = vector<Mesh*>();
+    auto streamed_meshes = false;
+    auto key = string();
+    reader.begin_object();
+    while(reader.next_key(key)) {
+        if(key == "meshes" and reader.next_type() == jsonvalue::arrayt) { meshes = json_read_meshes(reader); streamed_meshes = true; }
+        else json[key] = reader.read_value();
+    }
+    auto scene = json_parse_scene(jsonvalue(std::move(json)));
+    if(streamed_meshes) scene->meshes = meshes;
+    return scene;
+}
+
+// load the mesh files referenced by the pending meshes in parallel, then finish the meshes
+void json_load_pending_meshes(vector<JsonMeshValues>& pending) {
+    auto files = vector<const jsonvalue*>();
+    auto filenames = set<string>();
+    for(auto& values : pending) {
+        auto& json = values.json;
+        auto filename = json.object_element(json.object_contains("bin_mesh") ? "bin_mesh" : "json_mesh").as_string();
+        if(filenames.insert(filename).second) files.push_back(&json);
+    }
+    parallel_for(files.size(), [&files](int i){ json_cached_mesh_file(*files[i]); }, 1);
+    for(auto& values : pending) json_finish_mesh(values, values.mesh);
+}
+
+// scenes are parsed on the calling thread, while the referenced mesh files are loaded and
+// the textures decoded in parallel afterwards (meshes first, since they may add textures)
 Scene* load_json_scene(const string& filename) {
     json_texture_cache.clear();
+    json_mesh_cache_clear();
     json_texture_paths = { "" };
-    auto scene = json_parse_scene(load_json(filename));
+    json_texture_deferred = true;
+    auto pending = vector<JsonMeshValues>();
+    json_pending_meshes = &pending;
+    jsonreader reader(filename);
+    auto scene = json_read_scene(reader);
+    json_pending_meshes = nullptr;
+    json_load_pending_meshes(pending);
+    json_load_textures();
+    json_texture_deferred = false;
     json_texture_cache.clear();
+    json_mesh_cache_clear();
     json_texture_paths = { "" };
+    share_mesh_geometry(scene);
     return scene;
 }
 
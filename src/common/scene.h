@@ -6,6 +6,9 @@
 #include "vmath.h"
 #include "image.h"
 
+#include <cstdint>
+#include <memory>
+
 // forward declarations
 struct BVHAccelerator;
 
@@ -29,6 +32,40 @@ struct Material {
 };
 
 
+// mesh connectivity: unique edges and the face/edge/vertex adjacency of triangles and quads
+// faces are numbered with all triangles first, followed by all quads (face id = triangle.size() + quad id)
+// face edge k joins face vertices k and k+1; adjacency lists are stored in CSR form (offset, list)
+struct MeshTopology {
+    vector<vec2i>   edge;                   // unique edges, in order of first appearance
+    vector<vec3i>   triangle_edge;          // edges of each triangle
+    vector<vec4i>   quad_edge;              // edges of each quad
+    vector<vec2i>   edge_face;              // first two faces adjacent to each edge (-1 if missing)
+    vector<int>     edge_face_count;        // number of faces adjacent to each edge
+    vector<int>     vert_edge_offset;       // per-vertex offsets into vert_edge (one more than the vertices)
+    vector<int>     vert_edge;              // edges adjacent to each vertex, sorted by edge id
+    vector<int>     vert_face_offset;       // per-vertex offsets into vert_face (one more than the vertices)
+    vector<int>     vert_face;              // faces adjacent to each vertex, sorted by face id
+    int             boundary_edges = 0;     // number of edges with a single adjacent face
+    int             nonmanifold_edges = 0;  // number of edges with more than two adjacent faces
+};
+
+// weighting of face normals when computing smooth vertex normals
+enum NormalWeighting {
+    normal_weighting_uniform,   // all adjacent faces count the same
+    normal_weighting_area,      // faces are weighted by their area
+    normal_weighting_angle      // faces are weighted by their angle at the vertex
+};
+
+// header of binary mesh files, followed by the mesh arrays pos, norm, texcoord, triangle,
+// quad, point, line and spline in native byte order, each starting at a 16-byte aligned offset
+struct BinMeshHeader {
+    char        magic[4] = {'B','M','S','H'};   // file signature
+    uint32_t    version = 1;                    // format version
+    uint64_t    key = 0;                        // user key (e.g. content hash of the source)
+    uint64_t    count[8] = {0};                 // number of elements of each array
+    uint64_t    offset[8] = {0};                // byte offset of each array in the file
+};
+
 // indexed mesh data structure with vertex positions and normals,
 // a list of indices for triangle and quad faces, material and frame
 struct Mesh {
@@ -47,7 +84,13 @@ struct Mesh {
     bool subdivision_catmullclark_smooth = false;   // catmullclark subdiv smooth
     int  subdivision_bezier_level = 0;              // bezier subdiv level
     bool subdivision_bezier_uniform = true;         // bezier subdiv: true=uniform, false=de casteljau
+    float subdivision_bezier_flatness = 0;          // bezier subdiv: if > 0, adaptive de casteljau up to this world-space flatness
+    NormalWeighting subdivision_normal_weighting = normal_weighting_uniform; // smooth normals weighting
     
+    Mesh*           geometry = nullptr;         // shared geometry: if set, this mesh is an instance drawn
+                                                // with the arrays of geometry, and its own arrays are empty
+    
+    std::shared_ptr<MeshTopology> _topology;    // cached topology (see mesh_topology), shared by copies
 
 };
 
@@ -115,6 +158,38 @@ struct Scene {
     
 };
 
+// build the topology of a set of triangles and quads over nverts vertices in linear time
+MeshTopology make_mesh_topology(const vector<vec3i>& triangle, const vector<vec4i>& quad, int nverts);
+
+// build the vertex to face adjacency of a set of triangles and quads over nverts vertices (see MeshTopology)
+void make_vert_face(const vector<vec3i>& triangle, const vector<vec4i>& quad, int nverts,
+                    vector<int>& vert_face_offset, vector<int>& vert_face);
+
+// get the cached topology of a mesh, building it if needed
+const MeshTopology* mesh_topology(Mesh* mesh);
+
+// clear the cached topology of a mesh (call after changing its faces)
+void mesh_topology_clear(Mesh* mesh);
+
+// hash of the mesh arrays and subdivision parameters (frame and material are not included),
+// combined with seed
+uint64_t mesh_hash(const Mesh* mesh, uint64_t seed = 0);
+
+// save the mesh arrays in a binary mesh file (see BinMeshHeader), storing key in its header;
+// returns false if the file cannot be written
+bool save_bin_mesh(const string& filename, const Mesh* mesh, uint64_t key = 0);
+
+// load the mesh arrays from a binary mesh file (memory-mapped where available); returns false,
+// leaving mesh untouched, if the file is missing or invalid or if key is not zero and differs from the stored one
+bool load_bin_mesh(const string& filename, Mesh* mesh, uint64_t key = 0);
+
+// make meshes with the same arrays and subdivision parameters instances of the first of them (see Mesh::geometry),
+// so that they share storage and are subdivided once
+void share_mesh_geometry(Scene* scene);
+
+// geometry of a mesh, either shared or its own
+inline Mesh* mesh_geometry(Mesh* mesh) { return (mesh->geometry) ? mesh->geometry : mesh; }
+
 // grab all scene textures
 vector<image3f*> get_textures(Scene* scene);
 
@@ -127,6 +202,10 @@ void set_view_turntable(Camera* camera, float rotate_phi, float rotate_theta, fl
 // load a scene from a json file
 Scene* load_json_scene(const string& filename);
 
+// load a mesh from a json file (as referenced by "json_mesh"; meshes can also reference
+// binary mesh files with "bin_mesh", see save_bin_mesh)
+Mesh* load_json_mesh(const string& filename);
+
 // create test scenes that do not need to be loaded from a file
 Scene* create_test_scene(int scene_type);
 
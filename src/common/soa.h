@@ -0,0 +1,80 @@
+#ifndef _SOA_H_
+#define _SOA_H_
+
+#include "common.h"
+#include "vmath.h"
+
+#include <cstdint>
+#include <cstdlib>
+
+// allocator returning memory aligned to Align bytes (suitable for SSE/AVX loads)
+// the pointer returned by malloc is stored just before the aligned block
+template<typename T, int Align = 32>
+struct aligned_allocator {
+    typedef T value_type;
+    template<typename U> struct rebind { typedef aligned_allocator<U,Align> other; };
+
+    // constructors
+    aligned_allocator() { }
+    template<typename U> aligned_allocator(const aligned_allocator<U,Align>&) { }
+
+    // allocate n elements
+    T* allocate(size_t n) {
+        auto raw = malloc(n*sizeof(T) + Align);
+        error_if_not(raw, "out of memory");
+        auto ptr = ((uintptr_t)raw + Align) & ~(uintptr_t)(Align-1);
+        ((void**)ptr)[-1] = raw;
+        return (T*)ptr;
+    }
+    // free elements
+    void deallocate(T* ptr, size_t) { if(ptr) free(((void**)ptr)[-1]); }
+};
+template<typename T, typename U, int Align>
+inline bool operator==(const aligned_allocator<T,Align>&, const aligned_allocator<U,Align>&) { return true; }
+template<typename T, typename U, int Align>
+inline bool operator!=(const aligned_allocator<T,Align>&, const aligned_allocator<U,Align>&) { return false; }
+
+// aligned float array
+typedef vector<float,aligned_allocator<float>> aligned_floatarray;
+
+// structure-of-arrays buffer of 3d vectors
+// x, y and z components are stored in separate contiguous aligned arrays, so that
+// geometry kernels can process several vectors at a time on each component
+struct vec3f_soa {
+    aligned_floatarray x; // X components
+    aligned_floatarray y; // Y components
+    aligned_floatarray z; // Z components
+
+    // Default constructor (empty)
+    vec3f_soa() { }
+    // Sized constructor (set to zeros)
+    explicit vec3f_soa(int n) : x(n), y(n), z(n) { }
+    // Conversion from the interleaved layout
+    explicit vec3f_soa(const vector<vec3f>& v) : x(v.size()), y(v.size()), z(v.size()) {
+        for(auto i : range(v.size())) { x[i] = v[i].x; y[i] = v[i].y; z[i] = v[i].z; }
+    }
+
+    // number of vectors
+    int size() const { return x.size(); }
+    // resize
+    void resize(int n) { x.resize(n); y.resize(n); z.resize(n); }
+
+    // component array access
+    float* operator[](int c) { return (c == 0) ? x.data() : ((c == 1) ? y.data() : z.data()); }
+    // component array access
+    const float* operator[](int c) const { return (c == 0) ? x.data() : ((c == 1) ? y.data() : z.data()); }
+
+    // element get
+    vec3f get(int i) const { return vec3f(x[i],y[i],z[i]); }
+    // element set
+    void set(int i, const vec3f& v) { x[i] = v.x; y[i] = v.y; z[i] = v.z; }
+
+    // conversion to the interleaved layout (as used by OpenGL vertex arrays)
+    vector<vec3f> aos() const {
+        auto v = vector<vec3f>(size());
+        for(auto i : range(size())) v[i] = vec3f(x[i],y[i],z[i]);
+        return v;
+    }
+};
+
+#endif
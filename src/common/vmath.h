@@ -5,6 +5,19 @@
 #include <cstdlib>
 #include <array>
 
+// simd backend ----------------------------
+// VMATH_SIMD selects SSE versions of the vec4f and mat4f arithmetic and of the batch
+// functions at the end of this file; it is on by default when compiling for SSE2
+// (define it to 0 to force the scalar code). Both versions perform the same floating
+// point operations in the same order, so they return identical results, unless the compiler
+// contracts the scalar multiply-adds into fma instructions (checked by vmath_test).
+#if not defined(VMATH_SIMD) and defined(__SSE2__)
+#define VMATH_SIMD 1
+#endif
+#if VMATH_SIMD
+#include <emmintrin.h>
+#endif
+
 #define PIf 3.14159265f
 #define PI 3.1415926535897932384626433832795
 
@@ -272,6 +285,21 @@ inline bool operator==(const vec4f& a, const vec4f& b) { return a.x==b.x and a.y
 
 // 4d component-wise arithmetic operators -----------
 inline vec4f operator-(const vec4f& a) { return vec4f(-a.x, -a.y, -a.z, -a.w); }
+#if VMATH_SIMD
+inline __m128 _simd_load(const vec4f& a) { return _mm_loadu_ps(&a.x); }
+inline vec4f _simd_vec4f(__m128 a) { vec4f ret; _mm_storeu_ps(&ret.x, a); return ret; }
+inline vec4f operator+(const vec4f& a, const vec4f& b) { return _simd_vec4f(_mm_add_ps(_simd_load(a),_simd_load(b))); }
+inline vec4f& operator+=(vec4f& a, const vec4f& b) { a = a + b; return a; }
+inline vec4f operator-(const vec4f& a, const vec4f& b) { return _simd_vec4f(_mm_sub_ps(_simd_load(a),_simd_load(b))); }
+inline vec4f& operator-=(vec4f& a, const vec4f& b) { a = a - b; return a; }
+inline vec4f operator*(const vec4f& a, const vec4f& b) { return _simd_vec4f(_mm_mul_ps(_simd_load(a),_simd_load(b))); }
+inline vec4f& operator*=(vec4f& a, const vec4f& b) { a = a * b; return a; }
+inline vec4f operator/(const vec4f& a, const vec4f& b) { return _simd_vec4f(_mm_div_ps(_simd_load(a),_simd_load(b))); }
+inline vec4f& operator/=(vec4f& a, const vec4f& b) { a = a / b; return a; }
+inline vec4f operator*(const vec4f& a, float b) { return _simd_vec4f(_mm_mul_ps(_simd_load(a),_mm_set1_ps(b))); }
+inline vec4f operator*(float a, const vec4f& b) { return _simd_vec4f(_mm_mul_ps(_mm_set1_ps(a),_simd_load(b))); }
+inline vec4f& operator*=(vec4f& a, float b) { a = a * b; return a; }
+#else
 inline vec4f operator+(const vec4f& a, const vec4f& b) { return vec4f(a.x+b.x, a.y+b.y, a.z+b.z, a.w+b.w); }
 inline vec4f& operator+=(vec4f& a, const vec4f& b) { a.x+=b.x; a.y+=b.y; a.z+=b.z; a.w+=b.w; return a; }
 inline vec4f operator-(const vec4f& a, const vec4f& b) { return vec4f(a.x-b.x, a.y-b.y, a.z-b.z, a.w-b.w); }
@@ -283,6 +311,7 @@ inline vec4f& operator/=(vec4f& a, const vec4f& b) { a.x/=b.x; a.y/=b.y; a.z/=b.
 inline vec4f operator*(const vec4f& a, float b) { return vec4f(a.x*b, a.y*b, a.z*b, a.w*b); }
 inline vec4f operator*(float a, const vec4f& b) { return vec4f(a*b.x, a*b.y, a*b.z, a*b.w); }
 inline vec4f& operator*=(vec4f& a, float b) { a.x*=b; a.y*=b; a.z*=b; a.w*=b; return a; }
+#endif
 template<typename T, typename R> inline vec4f operator*(const vec4f& a, const R& b) { return vec4f(a.x*b, a.y*b, a.z*b, a.w*b); }
 template<typename T, typename R> inline vec4f operator*(const R& a, const vec4f& b) { return vec4f(a*b.x, a*b.y, a*b.z, a*b.w); }
 template<typename T, typename R> inline vec4f& operator*=(vec4f& a, const R& b) { a.x*=b; a.y*=b; a.z*=b; a.w*=b; return a; }
@@ -607,9 +636,20 @@ inline mat4f& operator*=(mat4f& a, float b) { a.x*=b; a.y*=b; a.z*=b; a.w*=b; re
 inline mat4f operator/(const mat4f& a, float b) { return mat4f(a.x/b, a.y/b, a.z/b, a.w/b); }
 inline mat4f& operator/=(mat4f& a, float b) { a.x/=b; a.y/=b; a.z/=b; a.w/=b; return a; }
 
+#if VMATH_SIMD
+// each row of the product accumulates the rows of b weighted by the elements of a row of a
+inline vec4f _simd_row_mul(const vec4f& a, const mat4f& b) { return _simd_vec4f(_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a.x),_simd_load(b.x)), _mm_mul_ps(_mm_set1_ps(a.y),_simd_load(b.y))), _mm_mul_ps(_mm_set1_ps(a.z),_simd_load(b.z))), _mm_mul_ps(_mm_set1_ps(a.w),_simd_load(b.w)))); }
+inline mat4f operator*(const mat4f& a, const mat4f& b) { return mat4f(_simd_row_mul(a.x,b), _simd_row_mul(a.y,b), _simd_row_mul(a.z,b), _simd_row_mul(a.w,b)); }
+#else
 inline mat4f operator*(const mat4f& a, const mat4f& b) { return mat4f(a.x.x*b.x.x+a.x.y*b.y.x+a.x.z*b.z.x+a.x.w*b.w.x , a.x.x*b.x.y+a.x.y*b.y.y+a.x.z*b.z.y+a.x.w*b.w.y , a.x.x*b.x.z+a.x.y*b.y.z+a.x.z*b.z.z+a.x.w*b.w.z , a.x.x*b.x.w+a.x.y*b.y.w+a.x.z*b.z.w+a.x.w*b.w.w  , a.y.x*b.x.x+a.y.y*b.y.x+a.y.z*b.z.x+a.y.w*b.w.x , a.y.x*b.x.y+a.y.y*b.y.y+a.y.z*b.z.y+a.y.w*b.w.y , a.y.x*b.x.z+a.y.y*b.y.z+a.y.z*b.z.z+a.y.w*b.w.z , a.y.x*b.x.w+a.y.y*b.y.w+a.y.z*b.z.w+a.y.w*b.w.w  , a.z.x*b.x.x+a.z.y*b.y.x+a.z.z*b.z.x+a.z.w*b.w.x , a.z.x*b.x.y+a.z.y*b.y.y+a.z.z*b.z.y+a.z.w*b.w.y , a.z.x*b.x.z+a.z.y*b.y.z+a.z.z*b.z.z+a.z.w*b.w.z , a.z.x*b.x.w+a.z.y*b.y.w+a.z.z*b.z.w+a.z.w*b.w.w  , a.w.x*b.x.x+a.w.y*b.y.x+a.w.z*b.z.x+a.w.w*b.w.x , a.w.x*b.x.y+a.w.y*b.y.y+a.w.z*b.z.y+a.w.w*b.w.y , a.w.x*b.x.z+a.w.y*b.y.z+a.w.z*b.z.z+a.w.w*b.w.z , a.w.x*b.x.w+a.w.y*b.y.w+a.w.z*b.z.w+a.w.w*b.w.w  ); }
+#endif
 inline mat4f& operator*=(mat4f& a, const mat4f& b) { a = a*b; return a; }
+#if VMATH_SIMD
+// the columns of a, weighted by the elements of b, are accumulated in the order of dot()
+inline vec4f operator*(const mat4f& a, const vec4f& b) { auto x = _simd_load(a.x), y = _simd_load(a.y), z = _simd_load(a.z), w = _simd_load(a.w); _MM_TRANSPOSE4_PS(x, y, z, w); return _simd_vec4f(_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x,_mm_set1_ps(b.x)), _mm_mul_ps(y,_mm_set1_ps(b.y))), _mm_mul_ps(z,_mm_set1_ps(b.z))), _mm_mul_ps(w,_mm_set1_ps(b.w)))); }
+#else
 inline vec4f operator*(const mat4f& a, const vec4f& b) { return vec4f(dot(a.x,b), dot(a.y,b), dot(a.z,b), dot(a.w,b)); }
+#endif
 
 // 4x4 matrix operations ----------------------------
 inline mat4f transpose(const mat4f& a) { return mat4f(a.x.x, a.y.x, a.z.x, a.w.x , a.x.y, a.y.y, a.z.y, a.w.y , a.x.z, a.y.z, a.z.z, a.w.z , a.x.w, a.y.w, a.z.w, a.w.w ); }
@@ -698,5 +738,93 @@ inline range3f rscale(const range3f& a, float b) { return range3f(center(a)-size
 inline range3f make_range3f(std::initializer_list<vec3f> points) { auto bbox = range3f(); for(auto& p : points) bbox = runion(bbox,p); return bbox; }
 inline std::array<vec3f,8> corners(const range3f& a) { std::array<vec3f,8> ret; ret[0] = vec3f(a.min.x,a.min.y,a.min.z); ret[1] = vec3f(a.min.x,a.min.y,a.max.z); ret[2] = vec3f(a.min.x,a.max.y,a.min.z); ret[3] = vec3f(a.min.x,a.max.y,a.max.z); ret[4] = vec3f(a.max.x,a.min.y,a.min.z); ret[5] = vec3f(a.max.x,a.min.y,a.max.z); ret[6] = vec3f(a.max.x,a.max.y,a.min.z); ret[7] = vec3f(a.max.x,a.max.y,a.max.z); return ret; }
 
+// batch operations ---------------------------------
+// apply the single element operation to n elements of v, storing the results in ret (which can be v)
+// with VMATH_SIMD, normalization and projective transforms process four elements at a time on
+// component registers; the remaining loops are left to the compiler, which vectorizes them already
+#if VMATH_SIMD
+// load four interleaved vec3f as component registers
+inline void _simd_load4(const vec3f* v, __m128& x, __m128& y, __m128& z) {
+    auto m0 = _mm_loadu_ps(&v[0].x), m1 = _mm_loadu_ps(&v[1].y), m2 = _mm_loadu_ps(&v[2].z);
+    x = _mm_shuffle_ps(m0, _mm_shuffle_ps(m1,m2,_MM_SHUFFLE(1,1,2,2)), _MM_SHUFFLE(2,0,3,0));
+    y = _mm_shuffle_ps(_mm_shuffle_ps(m0,m1,_MM_SHUFFLE(0,0,1,1)), _mm_shuffle_ps(m1,m2,_MM_SHUFFLE(2,2,3,3)), _MM_SHUFFLE(2,0,2,0));
+    z = _mm_shuffle_ps(_mm_shuffle_ps(m0,m1,_MM_SHUFFLE(1,1,2,2)), m2, _MM_SHUFFLE(3,0,2,0));
+}
+// store component registers as four interleaved vec3f
+inline void _simd_store4(vec3f* v, __m128 x, __m128 y, __m128 z) {
+    _mm_storeu_ps(&v[0].x, _mm_shuffle_ps(_mm_shuffle_ps(x,y,_MM_SHUFFLE(0,0,0,0)), _mm_shuffle_ps(z,x,_MM_SHUFFLE(1,1,0,0)), _MM_SHUFFLE(2,0,2,0)));
+    _mm_storeu_ps(&v[1].y, _mm_shuffle_ps(_mm_shuffle_ps(y,z,_MM_SHUFFLE(1,1,1,1)), _mm_shuffle_ps(x,y,_MM_SHUFFLE(2,2,2,2)), _MM_SHUFFLE(2,0,2,0)));
+    _mm_storeu_ps(&v[2].z, _mm_shuffle_ps(_mm_shuffle_ps(z,x,_MM_SHUFFLE(3,3,2,2)), _mm_shuffle_ps(y,z,_MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(2,0,2,0)));
+}
+// a * b + c * d + e * f
+inline __m128 _simd_dot3(float a, __m128 b, float c, __m128 d, float e, __m128 f) { return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a),b), _mm_mul_ps(_mm_set1_ps(c),d)), _mm_mul_ps(_mm_set1_ps(e),f)); }
+#endif
+
+// precision of batch normalization
+// the approximate modes apply only to the simd lanes; without VMATH_SIMD all modes are exact
+enum NormalizePrecision {
+    normalize_exact,        // same results as normalize()
+    normalize_fast,         // reciprocal square root estimate refined by one Newton step (relative error below 1e-6)
+    normalize_approx,       // reciprocal square root estimate (relative error below 4e-4)
+};
+
+#if VMATH_SIMD
+// normalize four vectors held in component registers; zero-length vectors stay zero
+// (in the approximate modes, so do vectors whose squared length is denormal or overflows)
+inline void _simd_normalize(__m128& x, __m128& y, __m128& z, NormalizePrecision precision) {
+    auto l2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x,x),_mm_mul_ps(y,y)),_mm_mul_ps(z,z));
+    if(precision == normalize_exact) {
+        auto l = _mm_sqrt_ps(l2);
+        auto nonzero = _mm_cmpneq_ps(l,_mm_setzero_ps());
+        x = _mm_and_ps(nonzero,_mm_div_ps(x,l)); y = _mm_and_ps(nonzero,_mm_div_ps(y,l)); z = _mm_and_ps(nonzero,_mm_div_ps(z,l));
+    } else {
+        auto il = _mm_rsqrt_ps(l2);
+        if(precision == normalize_fast) il = _mm_mul_ps(il, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f),l2), _mm_mul_ps(il,il))));
+        il = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(l2,_mm_set1_ps(1.17549435e-38f)),_mm_cmple_ps(l2,_mm_set1_ps(3.40282347e+38f))), il);
+        x = _mm_mul_ps(x,il); y = _mm_mul_ps(y,il); z = _mm_mul_ps(z,il);
+    }
+}
+#endif
+
+// normalize n vectors
+inline void normalize_batch(const vec3f* v, vec3f* ret, int n, NormalizePrecision precision = normalize_exact) {
+    auto i = 0;
+#if VMATH_SIMD
+    for(; i+4 <= n; i += 4) {
+        __m128 x, y, z; _simd_load4(v+i, x, y, z);
+        _simd_normalize(x, y, z, precision);
+        _simd_store4(ret+i, x, y, z);
+    }
+#endif
+    for(; i < n; i++) ret[i] = normalize(v[i]);
+}
+// transform n points by a frame
+inline void transform_point_batch(const frame3f& f, const vec3f* v, vec3f* ret, int n) { for(auto i = 0; i < n; i++) ret[i] = transform_point(f,v[i]); }
+// transform n vectors by a frame
+inline void transform_vector_batch(const frame3f& f, const vec3f* v, vec3f* ret, int n) { for(auto i = 0; i < n; i++) ret[i] = transform_vector(f,v[i]); }
+// transform n points by a matrix
+inline void transform_point_batch(const mat4f& m, const vec3f* v, vec3f* ret, int n) {
+    auto i = 0;
+#if VMATH_SIMD
+    for(; i+4 <= n; i += 4) {
+        __m128 x, y, z; _simd_load4(v+i, x, y, z);
+        auto w = _mm_add_ps(_simd_dot3(m.w.x,x,m.w.y,y,m.w.z,z), _mm_set1_ps(m.w.w));
+        _simd_store4(ret+i,
+            _mm_div_ps(_mm_add_ps(_simd_dot3(m.x.x,x,m.x.y,y,m.x.z,z), _mm_set1_ps(m.x.w)), w),
+            _mm_div_ps(_mm_add_ps(_simd_dot3(m.y.x,x,m.y.y,y,m.y.z,z), _mm_set1_ps(m.y.w)), w),
+            _mm_div_ps(_mm_add_ps(_simd_dot3(m.z.x,x,m.z.y,y,m.z.z,z), _mm_set1_ps(m.z.w)), w));
+    }
+#endif
+    for(; i < n; i++) ret[i] = transform_point(m,v[i]);
+}
+// transform n vectors by a matrix
+// (written out on components, since the simd mat4f product does not vectorize across elements)
+inline void transform_vector_batch(const mat4f& m, const vec3f* v, vec3f* ret, int n) {
+    for(auto i = 0; i < n; i++) {
+        auto p = v[i];
+        ret[i] = vec3f(m.x.x*p.x+m.x.y*p.y+m.x.z*p.z+m.x.w*0, m.y.x*p.x+m.y.y*p.y+m.y.z*p.z+m.y.w*0, m.z.x*p.x+m.z.y*p.y+m.z.z*p.z+m.z.w*0);
+    }
+}
+
 
 #endif